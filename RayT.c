@@ -1,8 +1,16 @@
 #include <stdio.h>
-#include <windows.h>
+#include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #define SDL_MAIN_HANDLED
 #include "SDL.h"
+#include "worker_pool.h"
+#include "frame_loop.h"
+#include "platform.h"
+#include "microbench.h"
+#include "golden.h"
+#include "profiler.h"
+#include "arena.h"
 
 #define WIDTH 1200
 #define HEIGHT 600
@@ -12,6 +20,30 @@
 #define COLOR_RAY_BLUR 0xbd6800
 #define RAYS_NUMBER 500
 #define RAY_THICKNESS 1
+#define TILE_HEIGHT 16
+#define RAYS_PER_JOB 32
+#define MAX_EMITTERS 8
+#define BLUR_RADIUS 8
+#define BLUR_PASSES 2
+#define BLUR_COLUMNS_PER_JOB 64
+#define LIGHT_EXPOSURE 2.0f
+#define GLOW_EXPOSURE 1.0f
+#define BENCH_LIGHT_PERIOD 100
+#define FIXED_SHIFT 16
+#define PRECISION_TOLERANCE 0.01
+#define MICROBENCH_JSON "RayT_microbench.json"
+// obstacle steps per second, its speed is per step
+#define STEP_RATE 100
+
+// Number type used to step along the rays, double is the reference
+enum RayPrecision {
+    PRECISION_DOUBLE,
+    PRECISION_FLOAT,
+    PRECISION_FIXED,
+    PRECISION_COUNT
+};
+
+const char* precision_names[PRECISION_COUNT] = {"double", "float", "fixed16.16"};
 
 #undef main
 
@@ -47,36 +79,493 @@ void generate_rays(struct Circle circle, struct Ray rays[RAYS_NUMBER]) {
     }
 }
 
-void FillRays(SDL_Surface* surface, struct Ray rays[RAYS_NUMBER], Uint32 color, Uint32 blur_color, struct Circle object) {
+Uint32 NextRandom(Uint32* state) {
+    *state = *state * 1664525u + 1013904223u;
+    return *state >> 8;
+}
 
-    double radius_squared = pow(object.radius, 2);
-    for (int i = 0; i < RAYS_NUMBER; i++) {
-        struct Ray ray = rays[i];
-
-        int end_of_screen = 0;
-        int object_hit = 0;
-
-        double step = 1;
-        double x_draw = ray.x_start;
-        double y_draw = ray.y_start;
-        while (!end_of_screen && !object_hit) {
-            x_draw += step * cos(ray.angle);
-            y_draw += step * sin(ray.angle);  
-
-            SDL_Rect ray_point = (SDL_Rect) {x_draw, y_draw, RAY_THICKNESS, RAY_THICKNESS};
-            double blur_point = 3 * RAY_THICKNESS;
-            SDL_Rect ray_blur = (SDL_Rect) {x_draw, y_draw, blur_point, blur_point};
-            SDL_FillRect(surface, &ray_point, color);
-
-            if (x_draw < 0 || x_draw > WIDTH) end_of_screen = 1;
-            if (y_draw < 0 || y_draw > HEIGHT) end_of_screen = 1;
-            
-            double dist_squared = pow(x_draw - object.x, 2) + pow(y_draw - object.y, 2);
-            if (dist_squared < radius_squared) {
-                break;
-            }
+// Area light: emitters are jittered inside the light circle, one per angular
+// stratum, and each casts a full set of rays. Returns the number of rays.
+int generate_area_rays(struct Circle circle, struct Ray rays[RAYS_NUMBER * MAX_EMITTERS], int emitters) {
+    Uint32 seed = 12345;
+    for (int e = 0; e < emitters; e++) {
+        double jitter_angle = (e + NextRandom(&seed) / (double) (1 << 24)) / emitters * 2 * M_PI;
+        double jitter_radius = circle.radius * sqrt(NextRandom(&seed) / (double) (1 << 24));
+        struct Circle emitter = {circle.x + jitter_radius * cos(jitter_angle), circle.y + jitter_radius * sin(jitter_angle), 0};
+        generate_rays(emitter, &rays[e * RAYS_NUMBER]);
+    }
+    return emitters * RAYS_NUMBER;
+}
+
+int generate_light_rays(struct Circle circle, struct Ray rays[RAYS_NUMBER * MAX_EMITTERS], int area_light) {
+    if (area_light) return generate_area_rays(circle, rays, MAX_EMITTERS);
+    generate_rays(circle, rays);
+    return RAYS_NUMBER;
+}
+
+// Number of steps a ray takes before it leaves the screen or hits the object
+int TraceRay(struct Ray ray, struct Circle object) {
+    double radius_squared = object.radius * object.radius;
+    double step_x = cos(ray.angle);
+    double step_y = sin(ray.angle);
+    int steps = 0;
+    while (1) {
+        ++steps;
+        double x_draw = ray.x_start + steps * step_x;
+        double y_draw = ray.y_start + steps * step_y;
+
+        if (x_draw < 0 || x_draw > WIDTH) break;
+        if (y_draw < 0 || y_draw > HEIGHT) break;
+
+        double dist_squared = (x_draw - object.x) * (x_draw - object.x) + (y_draw - object.y) * (y_draw - object.y);
+        if (dist_squared < radius_squared) break;
+    }
+    return steps;
+}
+
+int TraceRayFloat(struct Ray ray, struct Circle object) {
+    float radius_squared = (float) (object.radius * object.radius);
+    float x_start = (float) ray.x_start, y_start = (float) ray.y_start;
+    float object_x = (float) object.x, object_y = (float) object.y;
+    float step_x = cosf((float) ray.angle);
+    float step_y = sinf((float) ray.angle);
+    int steps = 0;
+    while (1) {
+        ++steps;
+        float x_draw = x_start + steps * step_x;
+        float y_draw = y_start + steps * step_y;
+
+        if (x_draw < 0 || x_draw > WIDTH) break;
+        if (y_draw < 0 || y_draw > HEIGHT) break;
+
+        float dist_squared = (x_draw - object_x) * (x_draw - object_x) + (y_draw - object_y) * (y_draw - object_y);
+        if (dist_squared < radius_squared) break;
+    }
+    return steps;
+}
+
+Sint32 ToFixed(double value) {
+    return (Sint32) lround(value * (1 << FIXED_SHIFT));
+}
+
+// 16.16 fixed point DDA: the position is advanced by integer adds only
+int TraceRayFixed(struct Ray ray, struct Circle object) {
+    Sint64 radius = ToFixed(object.radius);
+    Sint64 radius_squared = radius * radius;
+    Sint32 object_x = ToFixed(object.x), object_y = ToFixed(object.y);
+    Sint32 step_x = ToFixed(cos(ray.angle));
+    Sint32 step_y = ToFixed(sin(ray.angle));
+    Sint32 x_draw = ToFixed(ray.x_start);
+    Sint32 y_draw = ToFixed(ray.y_start);
+    int steps = 0;
+    while (1) {
+        ++steps;
+        x_draw += step_x;
+        y_draw += step_y;
+
+        if (x_draw < 0 || x_draw > (WIDTH << FIXED_SHIFT)) break;
+        if (y_draw < 0 || y_draw > (HEIGHT << FIXED_SHIFT)) break;
+
+        Sint64 dx = x_draw - object_x, dy = y_draw - object_y;
+        if (dx * dx + dy * dy < radius_squared) break;
+    }
+    return steps;
+}
+
+int TraceRayWith(struct Ray ray, struct Circle object, int precision) {
+    switch (precision) {
+        case PRECISION_FLOAT: return TraceRayFloat(ray, object);
+        case PRECISION_FIXED: return TraceRayFixed(ray, object);
+        default: return TraceRay(ray, object);
+    }
+}
+
+// Pixel positions along a ray in the same number type the ray was traced with
+struct RayStepper {
+    int precision;
+    double x, y, step_x, step_y;
+    float x_f, y_f, step_x_f, step_y_f;
+    Sint32 x_16, y_16, step_x_16, step_y_16;
+};
+
+struct RayStepper MakeRayStepper(struct Ray ray, int precision) {
+    struct RayStepper stepper;
+    stepper.precision = precision;
+    stepper.x = ray.x_start;
+    stepper.y = ray.y_start;
+    stepper.step_x = cos(ray.angle);
+    stepper.step_y = sin(ray.angle);
+    stepper.x_f = (float) ray.x_start;
+    stepper.y_f = (float) ray.y_start;
+    stepper.step_x_f = cosf((float) ray.angle);
+    stepper.step_y_f = sinf((float) ray.angle);
+    stepper.x_16 = ToFixed(ray.x_start);
+    stepper.y_16 = ToFixed(ray.y_start);
+    stepper.step_x_16 = ToFixed(stepper.step_x);
+    stepper.step_y_16 = ToFixed(stepper.step_y);
+    return stepper;
+}
+
+SDL_Rect RayPoint(const struct RayStepper* stepper, int step) {
+    switch (stepper->precision) {
+        case PRECISION_FLOAT:
+            return (SDL_Rect) {stepper->x_f + step * stepper->step_x_f, stepper->y_f + step * stepper->step_y_f, RAY_THICKNESS, RAY_THICKNESS};
+        case PRECISION_FIXED:
+            return (SDL_Rect) {(stepper->x_16 + step * stepper->step_x_16) >> FIXED_SHIFT, (stepper->y_16 + step * stepper->step_y_16) >> FIXED_SHIFT, RAY_THICKNESS, RAY_THICKNESS};
+        default:
+            return (SDL_Rect) {stepper->x + step * stepper->step_x, stepper->y + step * stepper->step_y, RAY_THICKNESS, RAY_THICKNESS};
+    }
+}
+
+// Range of steps whose y can land inside the rows of band, 0 if there are none
+int RaySpan(struct Ray ray, int steps, SDL_Rect band, int* first_step, int* last_step) {
+    double step_y = sin(ray.angle);
+    double first = 1, last = steps;
+    double low = band.y - RAY_THICKNESS - ray.y_start;
+    double high = band.y + band.h + 1 - ray.y_start;
+    if (step_y > 1e-9) {
+        first = SDL_max(first, ceil(low / step_y));
+        last = SDL_min(last, floor(high / step_y));
+    } else if (step_y < -1e-9) {
+        first = SDL_max(first, ceil(high / step_y));
+        last = SDL_min(last, floor(low / step_y));
+    } else if (low > 0 || high < 0) {
+        return 0;
+    }
+    *first_step = (int) first;
+    *last_step = (int) last;
+    return first <= last;
+}
+
+// Draws the part of a traced ray that falls into the rows of band
+void DrawRaySpan(SDL_Surface* surface, struct Ray ray, int steps, SDL_Rect band, Uint32 color, int precision) {
+    int first, last;
+    if (!RaySpan(ray, steps, band, &first, &last)) return;
+
+    struct RayStepper stepper = MakeRayStepper(ray, precision);
+    for (int i = first; i <= last; i++) {
+        SDL_Rect ray_point = RayPoint(&stepper, i);
+        SDL_Rect clipped;
+        if (SDL_IntersectRect(&ray_point, &band, &clipped))
+            SDL_FillRect(surface, &clipped, color);
+    }
+}
+
+// Adds intensity to every light buffer pixel the ray covers inside band
+void DepositRaySpan(float* light, struct Ray ray, int steps, SDL_Rect band, float intensity, int precision) {
+    int first, last;
+    if (!RaySpan(ray, steps, band, &first, &last)) return;
+
+    struct RayStepper stepper = MakeRayStepper(ray, precision);
+    for (int i = first; i <= last; i++) {
+        SDL_Rect ray_point = RayPoint(&stepper, i);
+        SDL_Rect clipped;
+        if (!SDL_IntersectRect(&ray_point, &band, &clipped)) continue;
+        for (int y = clipped.y; y < clipped.y + clipped.h; y++)
+            for (int x = clipped.x; x < clipped.x + clipped.w; x++)
+                light[y * WIDTH + x] += intensity;
+    }
+}
+
+void FillRays(SDL_Surface* surface, struct Ray rays[], int ray_count, Uint32 color, Uint32 blur_color, struct Circle object) {
+    SDL_Rect screen = (SDL_Rect) {0, 0, WIDTH, HEIGHT};
+    for (int i = 0; i < ray_count; i++) {
+        int steps = TraceRay(rays[i], object);
+        DrawRaySpan(surface, rays[i], steps, screen, color, PRECISION_DOUBLE);
+    }
+}
+
+// Floating point light accumulation: rays add into light, glow is its blurred copy
+struct LightBuffer {
+    float* light;
+    float* temp;
+    float* glow;
+};
+
+int CreateLightBuffer(struct LightBuffer* buffer) {
+    buffer->light = calloc(WIDTH * HEIGHT, sizeof(float));
+    buffer->temp = calloc(WIDTH * HEIGHT, sizeof(float));
+    buffer->glow = calloc(WIDTH * HEIGHT, sizeof(float));
+    return buffer->light && buffer->temp && buffer->glow ? 0 : -1;
+}
+
+void DestroyLightBuffer(struct LightBuffer* buffer) {
+    free(buffer->light);
+    free(buffer->temp);
+    free(buffer->glow);
+}
+
+// Running-sum box blur of one row, O(1) per pixel for any radius
+void BoxBlurRow(const float* src, float* dst, int width, int radius) {
+    float scale = 1.0f / (2 * radius + 1);
+    float sum = 0;
+    for (int x = 0; x < radius && x < width; x++)
+        sum += src[x];
+    for (int x = 0; x < width; x++) {
+        if (x + radius < width) sum += src[x + radius];
+        dst[x] = sum * scale;
+        if (x - radius >= 0) sum -= src[x - radius];
+    }
+}
+
+#ifdef __SSE__
+// Pixel x of four consecutive rows, one per lane
+static __m128 LoadRowLanes(const float* src, int x) {
+    return _mm_setr_ps(src[x], src[WIDTH + x], src[2 * WIDTH + x], src[3 * WIDTH + x]);
+}
+
+// One BoxBlurRow step of four rows at x
+static __m128 BlurRowLanesStep(const float* src, float* dst, __m128 sum, __m128 scale, int x, int width, int radius) {
+    float out[4];
+    if (x + radius < width) sum = _mm_add_ps(sum, LoadRowLanes(src, x + radius));
+    _mm_storeu_ps(out, _mm_mul_ps(sum, scale));
+    for (int lane = 0; lane < 4; lane++) dst[lane * WIDTH + x] = out[lane];
+    if (x - radius >= 0) sum = _mm_sub_ps(sum, LoadRowLanes(src, x - radius));
+    return sum;
+}
+#endif
+
+// BoxBlurRow over rows [y0, y1) of WIDTH wide buffers. Four rows share an
+// SSE register, one lane each: away from the edges four pixels of every row
+// are loaded and transposed, so each lane adds in BoxBlurRow's order and the
+// result is the same to the bit.
+void BoxBlurRows(const float* src, float* dst, int y0, int y1, int width, int radius) {
+    int y = y0;
+#ifdef __SSE__
+    __m128 scale = _mm_set1_ps(1.0f / (2 * radius + 1));
+    for (; y + 4 <= y1; y += 4) {
+        const float* rows = &src[y * WIDTH];
+        float* out_rows = &dst[y * WIDTH];
+        __m128 sum = _mm_setzero_ps();
+        for (int x = 0; x < radius && x < width; x++)
+            sum = _mm_add_ps(sum, LoadRowLanes(rows, x));
+        int x = 0;
+        for (; x < radius && x < width; x++)
+            sum = BlurRowLanesStep(rows, out_rows, sum, scale, x, width, radius);
+        for (; x + 3 + radius < width; x += 4) {
+            __m128 add0 = _mm_loadu_ps(&rows[x + radius]), add1 = _mm_loadu_ps(&rows[WIDTH + x + radius]);
+            __m128 add2 = _mm_loadu_ps(&rows[2 * WIDTH + x + radius]), add3 = _mm_loadu_ps(&rows[3 * WIDTH + x + radius]);
+            __m128 sub0 = _mm_loadu_ps(&rows[x - radius]), sub1 = _mm_loadu_ps(&rows[WIDTH + x - radius]);
+            __m128 sub2 = _mm_loadu_ps(&rows[2 * WIDTH + x - radius]), sub3 = _mm_loadu_ps(&rows[3 * WIDTH + x - radius]);
+            _MM_TRANSPOSE4_PS(add0, add1, add2, add3);
+            _MM_TRANSPOSE4_PS(sub0, sub1, sub2, sub3);
+            __m128 out0, out1, out2, out3;
+            sum = _mm_add_ps(sum, add0);
+            out0 = _mm_mul_ps(sum, scale);
+            sum = _mm_sub_ps(sum, sub0);
+            sum = _mm_add_ps(sum, add1);
+            out1 = _mm_mul_ps(sum, scale);
+            sum = _mm_sub_ps(sum, sub1);
+            sum = _mm_add_ps(sum, add2);
+            out2 = _mm_mul_ps(sum, scale);
+            sum = _mm_sub_ps(sum, sub2);
+            sum = _mm_add_ps(sum, add3);
+            out3 = _mm_mul_ps(sum, scale);
+            sum = _mm_sub_ps(sum, sub3);
+            _MM_TRANSPOSE4_PS(out0, out1, out2, out3);
+            _mm_storeu_ps(&out_rows[x], out0);
+            _mm_storeu_ps(&out_rows[WIDTH + x], out1);
+            _mm_storeu_ps(&out_rows[2 * WIDTH + x], out2);
+            _mm_storeu_ps(&out_rows[3 * WIDTH + x], out3);
         }
+        for (; x < width; x++)
+            sum = BlurRowLanesStep(rows, out_rows, sum, scale, x, width, radius);
+    }
+#endif
+    for (; y < y1; y++)
+        BoxBlurRow(&src[(size_t) y * WIDTH], &dst[(size_t) y * WIDTH], width, radius);
+}
+
+// Running-sum box blur down columns [x0, x1); walks whole row segments so the
+// inner loop is contiguous and four columns go through one SSE register
+void BoxBlurColumns(const float* src, float* dst, int x0, int x1, int height, int radius) {
+    float sums[BLUR_COLUMNS_PER_JOB] = {0};
+    float scale = 1.0f / (2 * radius + 1);
+    int count = x1 - x0;
+    for (int y = 0; y < radius && y < height; y++)
+        for (int x = 0; x < count; x++)
+            sums[x] += src[y * WIDTH + x0 + x];
+
+    for (int y = 0; y < height; y++) {
+        const float* add = y + radius < height ? &src[(y + radius) * WIDTH + x0] : NULL;
+        const float* sub = y - radius >= 0 ? &src[(y - radius) * WIDTH + x0] : NULL;
+        float* out = &dst[y * WIDTH + x0];
+        int x = 0;
+#ifdef __SSE__
+        __m128 scale4 = _mm_set1_ps(scale);
+        for (; x + 4 <= count; x += 4) {
+            __m128 sum = _mm_loadu_ps(&sums[x]);
+            if (add) sum = _mm_add_ps(sum, _mm_loadu_ps(&add[x]));
+            _mm_storeu_ps(&out[x], _mm_mul_ps(sum, scale4));
+            if (sub) sum = _mm_sub_ps(sum, _mm_loadu_ps(&sub[x]));
+            _mm_storeu_ps(&sums[x], sum);
+        }
+#endif
+        for (; x < count; x++) {
+            if (add) sums[x] += add[x];
+            out[x] = sums[x] * scale;
+            if (sub) sums[x] -= sub[x];
+        }
+    }
+}
+
+// Hit distances from the previous frame. While the light stays put only rays
+// that can touch the old or the new occluder position are traced again; set
+// valid to 0 whenever the rays change.
+struct RayCache {
+    int ray_steps[RAYS_NUMBER * MAX_EMITTERS];
+    int valid;
+    struct Circle object;
+    SDL_atomic_t traced;
+};
+
+// 1 if any step of the ray can land inside circle (one pixel of slack)
+int RayMayHit(struct Ray ray, struct Circle circle) {
+    double dir_x = cos(ray.angle);
+    double dir_y = sin(ray.angle);
+    double to_x = circle.x - ray.x_start;
+    double to_y = circle.y - ray.y_start;
+    double reach = circle.radius + 1;
+    double along = to_x * dir_x + to_y * dir_y;
+    double across = to_x * dir_y - to_y * dir_x;
+    return along > -reach && fabs(across) < reach;
+}
+
+struct RayFrame {
+    SDL_Surface* surface;
+    struct Ray* rays;
+    int ray_count;
+    struct RayCache* cache;
+    int precision;
+    Uint32 color;
+    Uint32 blur_color;
+    struct Circle object;
+    struct LightBuffer* light;
+    float intensity;
+    const float* blur_source;
+};
+
+SDL_Rect TileBand(int index) {
+    return (SDL_Rect) {0, index * TILE_HEIGHT, WIDTH, SDL_min(TILE_HEIGHT, HEIGHT - index * TILE_HEIGHT)};
+}
+
+void TraceRaysJob(void* context, int index) {
+    struct RayFrame* frame = context;
+    struct RayCache* cache = frame->cache;
+    int end = SDL_min((index + 1) * RAYS_PER_JOB, frame->ray_count);
+    int traced = 0;
+    for (int i = index * RAYS_PER_JOB; i < end; i++) {
+        if (cache->valid && !RayMayHit(frame->rays[i], cache->object) && !RayMayHit(frame->rays[i], frame->object))
+            continue;
+        cache->ray_steps[i] = TraceRayWith(frame->rays[i], frame->object, frame->precision);
+        ++traced;
     }
+    SDL_AtomicAdd(&cache->traced, traced);
+}
+
+void TraceRays(struct WorkerPool* pool, struct RayFrame* frame) {
+    SDL_AtomicSet(&frame->cache->traced, 0);
+    DispatchJobs(pool, TraceRaysJob, frame, (frame->ray_count + RAYS_PER_JOB - 1) / RAYS_PER_JOB);
+    frame->cache->valid = 1;
+    frame->cache->object = frame->object;
+}
+
+void DrawTileJob(void* context, int index) {
+    struct RayFrame* frame = context;
+    SDL_Rect band = TileBand(index);
+    for (int i = 0; i < frame->ray_count; i++)
+        DrawRaySpan(frame->surface, frame->rays[i], frame->cache->ray_steps[i], band, frame->color, frame->precision);
+}
+
+void DepositTileJob(void* context, int index) {
+    struct RayFrame* frame = context;
+    SDL_Rect band = TileBand(index);
+    float* light = frame->light->light;
+    memset(&light[band.y * WIDTH], 0, band.h * WIDTH * sizeof(float));
+    for (int i = 0; i < frame->ray_count; i++)
+        DepositRaySpan(light, frame->rays[i], frame->cache->ray_steps[i], band, frame->intensity, frame->precision);
+}
+
+void BlurRowsJob(void* context, int index) {
+    struct RayFrame* frame = context;
+    SDL_Rect band = TileBand(index);
+    BoxBlurRows(frame->blur_source, frame->light->temp, band.y, band.y + band.h, WIDTH, BLUR_RADIUS);
+}
+
+void BlurColumnsJob(void* context, int index) {
+    struct RayFrame* frame = context;
+    int x0 = index * BLUR_COLUMNS_PER_JOB;
+    int x1 = SDL_min(x0 + BLUR_COLUMNS_PER_JOB, WIDTH);
+    BoxBlurColumns(frame->light->temp, frame->light->glow, x0, x1, HEIGHT, BLUR_RADIUS);
+}
+
+Uint8 ToneMap(float light, float glow, Uint32 color, Uint32 blur_color, int shift) {
+    float value = ((color >> shift) & 0xff) * (1.0f - expf(-LIGHT_EXPOSURE * light))
+                + ((blur_color >> shift) & 0xff) * (1.0f - expf(-GLOW_EXPOSURE * glow));
+    return value > 255 ? 255 : (Uint8) value;
+}
+
+void ToneMapTileJob(void* context, int index) {
+    struct RayFrame* frame = context;
+    SDL_Rect band = TileBand(index);
+    SDL_Surface* surface = frame->surface;
+    for (int y = band.y; y < band.y + band.h; y++) {
+        Uint32* row = (Uint32*) ((Uint8*) surface->pixels + y * surface->pitch);
+        for (int x = 0; x < WIDTH; x++) {
+            float light = frame->light->light[y * WIDTH + x];
+            float glow = frame->light->glow[y * WIDTH + x];
+            if (light == 0 && glow < 1e-4f) continue;
+            row[x] = SDL_MapRGB(surface->format,
+                                ToneMap(light, glow, frame->color, frame->blur_color, 16),
+                                ToneMap(light, glow, frame->color, frame->blur_color, 8),
+                                ToneMap(light, glow, frame->color, frame->blur_color, 0));
+        }
+    }
+}
+
+// Same image as FillRays: rays are traced in parallel, then every worker draws
+// its own horizontal tiles so no two threads write the same pixel. frame is
+// the caller's job context, filled in here.
+void FillRaysParallel(struct WorkerPool* pool, struct RayFrame* frame, struct RayCache* cache, SDL_Surface* surface, struct Ray rays[], int ray_count, Uint32 color, Uint32 blur_color, struct Circle object, int precision) {
+    frame->surface = surface;
+    frame->rays = rays;
+    frame->ray_count = ray_count;
+    frame->cache = cache;
+    frame->precision = precision;
+    frame->color = color;
+    frame->object = object;
+    TraceRays(pool, frame);
+    DispatchJobs(pool, DrawTileJob, frame, (HEIGHT + TILE_HEIGHT - 1) / TILE_HEIGHT);
+}
+
+// Rays add into the light buffer (each emitter carrying an equal share), the
+// buffer is box blurred into a glow layer and both are tone-mapped onto the
+// background. Expects a 32-bit surface.
+void FillRaysGlow(struct WorkerPool* pool, struct RayFrame* frame, struct RayCache* cache, struct LightBuffer* light, SDL_Surface* surface, struct Ray rays[], int ray_count, Uint32 color, Uint32 blur_color, struct Circle object, int precision) {
+    int tiles = (HEIGHT + TILE_HEIGHT - 1) / TILE_HEIGHT;
+    frame->surface = surface;
+    frame->rays = rays;
+    frame->ray_count = ray_count;
+    frame->cache = cache;
+    frame->precision = precision;
+    frame->color = color;
+    frame->blur_color = blur_color;
+    frame->object = object;
+    frame->light = light;
+    frame->intensity = (float) RAYS_NUMBER / ray_count;
+    TraceRays(pool, frame);
+    DispatchJobs(pool, DepositTileJob, frame, tiles);
+
+    frame->blur_source = light->light;
+    for (int pass = 0; pass < BLUR_PASSES; pass++) {
+        DispatchJobs(pool, BlurRowsJob, frame, tiles);
+        DispatchJobs(pool, BlurColumnsJob, frame, (WIDTH + BLUR_COLUMNS_PER_JOB - 1) / BLUR_COLUMNS_PER_JOB);
+        frame->blur_source = light->glow;
+    }
+
+    if (SDL_MUSTLOCK(surface)) SDL_LockSurface(surface);
+    DispatchJobs(pool, ToneMapTileJob, frame, tiles);
+    if (SDL_MUSTLOCK(surface)) SDL_UnlockSurface(surface);
 }
 
 void PrintWinEvent(const SDL_Event* event) {
@@ -139,38 +628,603 @@ void PrintWinEvent(const SDL_Event* event) {
     }
 }
 
-int APIENTRY WinMain(HINSTANCE hIsntance, HINSTANCE hPrevInstance, LPSTR lpCmdLine, int nShowCmd) {
-    if (SDL_Init(SDL_INIT_VIDEO) != 0) {
-        MessageBox(NULL, "SDL initialization failed.", "Error", MB_OK | MB_ICONERROR);
+// Everything one frame of the demo depends on
+struct Scene {
+    struct Circle circle;
+    struct Circle shadow_circle;
+    double previous_shadow_y;
+    double obstacle_speed_y;
+    int glow;
+    int area_light;
+    int precision;
+    int ray_count;
+    struct Ray rays[RAYS_NUMBER * MAX_EMITTERS];
+    struct RayCache cache;
+    // job context of the frame being drawn
+    struct RayFrame frame;
+};
+
+void InitScene(struct Scene* scene, int glow, int area_light) {
+    scene->circle = (struct Circle) {200, 200, 40};
+    scene->shadow_circle = (struct Circle) {600, 300, 140};
+    scene->previous_shadow_y = scene->shadow_circle.y;
+    scene->obstacle_speed_y = 4;
+    scene->glow = glow;
+    scene->area_light = area_light;
+    scene->precision = PRECISION_DOUBLE;
+    scene->ray_count = generate_light_rays(scene->circle, scene->rays, area_light);
+    scene->cache.valid = 0;
+}
+
+void MoveLight(struct Scene* scene, double x, double y) {
+    scene->circle.x = x;
+    scene->circle.y = y;
+    scene->ray_count = generate_light_rays(scene->circle, scene->rays, scene->area_light);
+    scene->cache.valid = 0;
+}
+
+void SetAreaLight(struct Scene* scene, int area_light) {
+    scene->area_light = area_light;
+    MoveLight(scene, scene->circle.x, scene->circle.y);
+}
+
+void SetPrecision(struct Scene* scene, int precision) {
+    scene->precision = precision;
+    scene->cache.valid = 0;
+}
+
+void StepScene(struct Scene* scene) {
+    struct Circle* shadow_circle = &scene->shadow_circle;
+    scene->previous_shadow_y = shadow_circle->y;
+    shadow_circle->y += scene->obstacle_speed_y;
+    if (shadow_circle->y - shadow_circle->radius < 0) scene->obstacle_speed_y = -scene->obstacle_speed_y;
+    if (shadow_circle->y + shadow_circle->radius > HEIGHT) scene->obstacle_speed_y = -scene->obstacle_speed_y;
+}
+
+// alpha blends the obstacle between its previous (0) and current (1) step
+void RenderScene(struct WorkerPool* pool, struct LightBuffer* light, struct Scene* scene, SDL_Surface* surface, double alpha) {
+    struct Circle shadow_circle = scene->shadow_circle;
+    shadow_circle.y = scene->previous_shadow_y * (1 - alpha) + scene->shadow_circle.y * alpha;
+    SDL_Rect erase_rect = (SDL_Rect) {0, 0, WIDTH, HEIGHT};
+    ProfileBegin("clear");
+    SDL_FillRect(surface, &erase_rect, COLOR_BLACK);
+    ProfileEnd();
+    ProfileBegin("rasterize");
+    if (scene->glow)
+        FillRaysGlow(pool, &scene->frame, &scene->cache, light, surface, scene->rays, scene->ray_count, COLOR_RAY, COLOR_RAY_BLUR, shadow_circle, scene->precision);
+    else
+        FillRaysParallel(pool, &scene->frame, &scene->cache, surface, scene->rays, scene->ray_count, COLOR_RAY, COLOR_RAY_BLUR, shadow_circle, scene->precision);
+    FillCircle(surface, scene->circle, COLOR_WHITE);
+    FillCircle(surface, shadow_circle, COLOR_WHITE);
+    ProfileEnd();
+}
+
+// Headless benchmark: renders frames of a fixed script into an offscreen
+// surface, prints frame time statistics and the MD5 of the last frame so
+// optimized kernels can be checked to be pixel exact
+int RunBenchmark(struct WorkerPool* pool, struct LightBuffer* light, int frames, int glow, int area_light, int precision) {
+    SDL_Surface* surface = SDL_CreateRGBSurfaceWithFormat(0, WIDTH, HEIGHT, 32, SDL_PIXELFORMAT_XRGB8888);
+    double* frame_ms = malloc(frames * sizeof(double));
+    static struct Scene scene;
+    if (!surface || !frame_ms) {
+        SDL_Log("Benchmark setup failed: %s", SDL_GetError());
+        SDL_FreeSurface(surface);
+        free(frame_ms);
+        return 1;
+    }
+
+    // the light visits a fixed set of positions, the occluder bounces as usual
+    const SDL_Point light_positions[] = {{200, 200}, {1000, 150}, {300, 500}, {900, 450}};
+    InitScene(&scene, glow, area_light);
+    SetPrecision(&scene, precision);
+    Uint64 frequency = SDL_GetPerformanceFrequency();
+    long long traced = 0;
+    for (int f = 0; f < frames; f++) {
+        if (f % BENCH_LIGHT_PERIOD == 0) {
+            SDL_Point position = light_positions[(f / BENCH_LIGHT_PERIOD) % SDL_arraysize(light_positions)];
+            MoveLight(&scene, position.x, position.y);
+        }
+        Uint64 start = SDL_GetPerformanceCounter();
+        RenderScene(pool, light, &scene, surface, 1);
+        frame_ms[f] = (SDL_GetPerformanceCounter() - start) * 1000.0 / frequency;
+        traced += SDL_AtomicGet(&scene.cache.traced);
+        StepScene(&scene);
+    }
+
+    char md5[GOLDEN_VALUE_LENGTH];
+    SurfaceMd5(surface, md5);
+
+    double total = 0;
+    for (int f = 0; f < frames; f++) total += frame_ms[f];
+    double median = Median(frame_ms, frames);
+    printf("frames %d threads %d mode %s%s precision %s\n", frames, pool->thread_count, glow ? "glow" : "lines", area_light ? " area" : "", precision_names[precision]);
+    printf("frame ms: min %.3f median %.3f p99 %.3f mean %.3f\n", frame_ms[0], median, frame_ms[(frames * 99 + 99) / 100 - 1], total / frames);
+    printf("rays traced per frame %.1f of %d\n", (double) traced / frames, scene.ray_count);
+    // without the "md5:" prefix of the golden values
+    printf("md5 %s\n", md5 + 4);
+
+    free(frame_ms);
+    SDL_FreeSurface(surface);
+    return 0;
+}
+
+// Traces the benchmark scene with every precision on one thread, reports
+// ray stepping throughput and compares the final line image against the
+// double precision one. Fails when more than PRECISION_TOLERANCE of the
+// lit pixels differ.
+int ComparePrecision(struct WorkerPool* pool, struct LightBuffer* light, int frames) {
+    static struct Scene scene;
+    SDL_Surface* surfaces[PRECISION_COUNT] = {0};
+    int result = 0;
+    Uint64 frequency = SDL_GetPerformanceFrequency();
+    for (int precision = 0; precision < PRECISION_COUNT; precision++) {
+        surfaces[precision] = SDL_CreateRGBSurfaceWithFormat(0, WIDTH, HEIGHT, 32, SDL_PIXELFORMAT_XRGB8888);
+        if (!surfaces[precision]) {
+            SDL_Log("Benchmark setup failed: %s", SDL_GetError());
+            result = 1;
+            break;
+        }
+
+        InitScene(&scene, 0, 0);
+        long long steps = 0;
+        Uint64 ticks = 0;
+        for (int f = 0; f < frames; f++) {
+            Uint64 start = SDL_GetPerformanceCounter();
+            for (int i = 0; i < scene.ray_count; i++)
+                steps += TraceRayWith(scene.rays[i], scene.shadow_circle, precision);
+            ticks += SDL_GetPerformanceCounter() - start;
+            StepScene(&scene);
+        }
+        double seconds = (double) ticks / frequency;
+        printf("%-10s %8.2f Mrays/s %6.2f ns/step\n", precision_names[precision], frames * scene.ray_count / seconds / 1e6, seconds * 1e9 / steps);
+
+        SetPrecision(&scene, precision);
+        RenderScene(pool, light, &scene, surfaces[precision], 1);
+    }
+
+    for (int precision = 1; precision < PRECISION_COUNT && result == 0; precision++) {
+        long lit = 0, different = 0;
+        for (int y = 0; y < HEIGHT; y++) {
+            Uint32* reference = (Uint32*) ((Uint8*) surfaces[PRECISION_DOUBLE]->pixels + y * surfaces[PRECISION_DOUBLE]->pitch);
+            Uint32* row = (Uint32*) ((Uint8*) surfaces[precision]->pixels + y * surfaces[precision]->pitch);
+            for (int x = 0; x < WIDTH; x++) {
+                lit += reference[x] != 0;
+                different += reference[x] != row[x];
+            }
+        }
+        double ratio = lit ? (double) different / lit : 0;
+        printf("%-10s %ld of %ld lit pixels differ (%.3f%%) %s\n", precision_names[precision], different, lit, ratio * 100, ratio <= PRECISION_TOLERANCE ? "ok" : "FAILED");
+        if (ratio > PRECISION_TOLERANCE) result = 1;
+    }
+
+    for (int precision = 0; precision < PRECISION_COUNT; precision++)
+        SDL_FreeSurface(surfaces[precision]);
+    return result;
+}
+
+// Inputs of the kernels timed by --microbench
+struct KernelInputs {
+    struct WorkerPool* pool;
+    struct LightBuffer* light;
+    SDL_Surface* surface;
+    struct Scene scene;
+    int precision;
+    long long steps;
+};
+
+void FillCircleKernel(void* context) {
+    struct KernelInputs* inputs = context;
+    FillCircle(inputs->surface, inputs->scene.shadow_circle, COLOR_WHITE);
+}
+
+void TraceRayKernel(void* context) {
+    struct KernelInputs* inputs = context;
+    for (int i = 0; i < inputs->scene.ray_count; i++)
+        inputs->steps += TraceRayWith(inputs->scene.rays[i], inputs->scene.shadow_circle, inputs->precision);
+}
+
+void FillRaysKernel(void* context) {
+    struct KernelInputs* inputs = context;
+    FillRays(inputs->surface, inputs->scene.rays, inputs->scene.ray_count, COLOR_RAY, COLOR_RAY_BLUR, inputs->scene.shadow_circle);
+}
+
+// both blur passes over the whole light buffer on one thread
+void BoxBlurRowKernel(void* context) {
+    struct KernelInputs* inputs = context;
+    for (int y = 0; y < HEIGHT; y++)
+        BoxBlurRow(&inputs->light->light[y * WIDTH], &inputs->light->temp[y * WIDTH], WIDTH, BLUR_RADIUS);
+}
+
+void BoxBlurRowsKernel(void* context) {
+    struct KernelInputs* inputs = context;
+    BoxBlurRows(inputs->light->light, inputs->light->temp, 0, HEIGHT, WIDTH, BLUR_RADIUS);
+}
+
+void BoxBlurColumnsKernel(void* context) {
+    struct KernelInputs* inputs = context;
+    for (int x0 = 0; x0 < WIDTH; x0 += BLUR_COLUMNS_PER_JOB)
+        BoxBlurColumns(inputs->light->temp, inputs->light->glow, x0, SDL_min(x0 + BLUR_COLUMNS_PER_JOB, WIDTH), HEIGHT, BLUR_RADIUS);
+}
+
+// the cache is dropped so every call traces all rays
+void FillRaysParallelKernel(void* context) {
+    struct KernelInputs* inputs = context;
+    inputs->scene.cache.valid = 0;
+    FillRaysParallel(inputs->pool, &inputs->scene.frame, &inputs->scene.cache, inputs->surface, inputs->scene.rays, inputs->scene.ray_count,
+                     COLOR_RAY, COLOR_RAY_BLUR, inputs->scene.shadow_circle, inputs->precision);
+}
+
+void FillRaysGlowKernel(void* context) {
+    struct KernelInputs* inputs = context;
+    inputs->scene.cache.valid = 0;
+    FillRaysGlow(inputs->pool, &inputs->scene.frame, &inputs->scene.cache, inputs->light, inputs->surface, inputs->scene.rays, inputs->scene.ray_count,
+                 COLOR_RAY, COLOR_RAY_BLUR, inputs->scene.shadow_circle, inputs->precision);
+}
+
+void RenderSceneKernel(void* context) {
+    struct KernelInputs* inputs = context;
+    inputs->scene.cache.valid = 0;
+    RenderScene(inputs->pool, inputs->light, &inputs->scene, inputs->surface, 1);
+}
+
+// Times the ray kernels on the first benchmark frame: the serial reference
+// next to the parallel, glow and reduced precision versions
+int RunMicrobenchmarks(struct WorkerPool* pool, struct LightBuffer* light, const char* json_path, const char* filter) {
+    static struct KernelInputs inputs;
+    struct Microbench bench;
+    inputs.pool = pool;
+    inputs.light = light;
+    inputs.surface = SDL_CreateRGBSurfaceWithFormat(0, WIDTH, HEIGHT, 32, SDL_PIXELFORMAT_XRGB8888);
+    if (!inputs.surface || OpenMicrobench(&bench, "RayT", json_path, filter) != 0) {
+        SDL_Log("Micro-benchmark setup failed: %s", SDL_GetError());
+        SDL_FreeSurface(inputs.surface);
         return 1;
     }
+    InitScene(&inputs.scene, 1, 0);
+    int rays = inputs.scene.ray_count;
+    double radius = inputs.scene.shadow_circle.radius;
 
-    SDL_Window* window = SDL_CreateWindow("Raytracing", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, WIDTH, HEIGHT, 0);
-    if (!window) {
-        MessageBox(NULL, "Window creation failed", "Error", MB_OK | MB_ICONERROR);
-        SDL_Quit();
+    RunMicrobench(&bench, "FillCircle r=140", FillCircleKernel, &inputs, M_PI * radius * radius, "pixel");
+    char name[64];
+    for (inputs.precision = 0; inputs.precision < PRECISION_COUNT; inputs.precision++) {
+        SDL_snprintf(name, sizeof(name), "TraceRay %s", precision_names[inputs.precision]);
+        RunMicrobench(&bench, name, TraceRayKernel, &inputs, rays, "ray");
+    }
+    inputs.precision = PRECISION_DOUBLE;
+    RunMicrobench(&bench, "FillRays", FillRaysKernel, &inputs, rays, "ray");
+    for (inputs.precision = 0; inputs.precision < PRECISION_COUNT; inputs.precision++) {
+        SDL_snprintf(name, sizeof(name), "FillRaysParallel %s", precision_names[inputs.precision]);
+        RunMicrobench(&bench, name, FillRaysParallelKernel, &inputs, rays, "ray");
+    }
+    inputs.precision = PRECISION_DOUBLE;
+    RunMicrobench(&bench, "BoxBlurRow", BoxBlurRowKernel, &inputs, WIDTH * HEIGHT, "pixel");
+    RunMicrobench(&bench, "BoxBlurRows", BoxBlurRowsKernel, &inputs, WIDTH * HEIGHT, "pixel");
+    RunMicrobench(&bench, "BoxBlurColumns", BoxBlurColumnsKernel, &inputs, WIDTH * HEIGHT, "pixel");
+    RunMicrobench(&bench, "FillRaysGlow", FillRaysGlowKernel, &inputs, rays, "ray");
+    RunMicrobench(&bench, "RenderScene", RenderSceneKernel, &inputs, WIDTH * HEIGHT, "pixel");
+
+    CloseMicrobench(&bench);
+    SDL_FreeSurface(inputs.surface);
+    return 0;
+}
+
+// Test cases of --test, each gets a fresh fixture from SetUpTest
+#define TEST_THREADS 3
+#define TEST_STEPS 60
+
+struct TestFixture {
+    struct WorkerPool pool;
+    struct LightBuffer light;
+    SDL_Surface* surface;
+    SDL_Surface* reference;
+    struct Scene scene;
+};
+
+static struct TestFixture fixture;
+
+void SetUpTest(void* arg) {
+    SDL_zero(fixture);
+    int result = CreateWorkerPool(&fixture.pool, TEST_THREADS) | CreateLightBuffer(&fixture.light);
+    fixture.surface = SDL_CreateRGBSurfaceWithFormat(0, WIDTH, HEIGHT, 32, SDL_PIXELFORMAT_XRGB8888);
+    fixture.reference = SDL_CreateRGBSurfaceWithFormat(0, WIDTH, HEIGHT, 32, SDL_PIXELFORMAT_XRGB8888);
+    SDLTest_AssertCheck(result == 0 && fixture.surface && fixture.reference, "Test setup");
+}
+
+void TearDownTest(void* arg) {
+    SDL_FreeSurface(fixture.surface);
+    SDL_FreeSurface(fixture.reference);
+    DestroyLightBuffer(&fixture.light);
+    DestroyWorkerPool(&fixture.pool);
+}
+
+// Renders TEST_STEPS frames of the demo scene, the ray cache included
+void RenderTestScene(struct WorkerPool* pool, SDL_Surface* surface, int glow, int area_light, int precision) {
+    InitScene(&fixture.scene, glow, area_light);
+    SetPrecision(&fixture.scene, precision);
+    for (int step = 0; step < TEST_STEPS; step++) {
+        RenderScene(pool, &fixture.light, &fixture.scene, surface, 1);
+        StepScene(&fixture.scene);
+    }
+}
+
+int CheckTestScene(const char* name, int glow, int area_light, int precision) {
+    char md5[GOLDEN_VALUE_LENGTH];
+    RenderTestScene(&fixture.pool, fixture.surface, glow, area_light, precision);
+    SurfaceMd5(fixture.surface, md5);
+    CheckGolden("RayT", name, md5);
+    return TEST_COMPLETED;
+}
+
+int TestSceneLines(void* arg) {
+    return CheckTestScene("lines", 0, 0, PRECISION_DOUBLE);
+}
+
+int TestSceneGlow(void* arg) {
+    return CheckTestScene("glow", 1, 0, PRECISION_DOUBLE);
+}
+
+int TestSceneArea(void* arg) {
+    return CheckTestScene("glow-area", 1, 1, PRECISION_DOUBLE);
+}
+
+int TestSceneFloat(void* arg) {
+    return CheckTestScene("lines-float", 0, 0, PRECISION_FLOAT);
+}
+
+int TestSceneFixed(void* arg) {
+    return CheckTestScene("lines-fixed", 0, 0, PRECISION_FIXED);
+}
+
+// Tiled drawing from the ray cache against FillRays tracing every ray
+int TestFillRaysParallel(void* arg) {
+    struct Scene* scene = &fixture.scene;
+    SDL_Rect screen = (SDL_Rect) {0, 0, WIDTH, HEIGHT};
+    int different = 0, lit = 0;
+    InitScene(scene, 0, 0);
+    for (int step = 0; step < TEST_STEPS; step++) {
+        RenderScene(&fixture.pool, &fixture.light, scene, fixture.surface, 1);
+        SDL_FillRect(fixture.reference, &screen, COLOR_BLACK);
+        FillRays(fixture.reference, scene->rays, scene->ray_count, COLOR_RAY, COLOR_RAY_BLUR, scene->shadow_circle);
+        FillCircle(fixture.reference, scene->circle, COLOR_WHITE);
+        FillCircle(fixture.reference, scene->shadow_circle, COLOR_WHITE);
+        different += CountDifferentPixels(fixture.reference, fixture.surface, 0, &lit);
+        StepScene(scene);
+    }
+    SDLTest_AssertCheck(different == 0, "FillRaysParallel matches FillRays, %d pixels differ", different);
+    return TEST_COMPLETED;
+}
+
+// One column at a time, the scalar reference of BoxBlurColumns
+void BoxBlurColumnReference(const float* src, float* dst, int x, int height, int radius) {
+    float scale = 1.0f / (2 * radius + 1);
+    float sum = 0;
+    for (int y = 0; y < radius && y < height; y++)
+        sum += src[y * WIDTH + x];
+    for (int y = 0; y < height; y++) {
+        if (y + radius < height) sum += src[(y + radius) * WIDTH + x];
+        dst[y * WIDTH + x] = sum * scale;
+        if (y - radius >= 0) sum -= src[(y - radius) * WIDTH + x];
+    }
+}
+
+// Pseudo-random light values in [0, 1), the same every run
+void FillTestLight(float* light) {
+    Uint32 seed = 1;
+    for (int i = 0; i < WIDTH * HEIGHT; i++) {
+        seed = seed * 1664525u + 1013904223u;
+        light[i] = (seed >> 8) * (1.0f / (1 << 24));
+    }
+}
+
+int TestBoxBlurRows(void* arg) {
+    float* src = fixture.light.light;
+    FillTestLight(src);
+    // uneven bands leave rows for the scalar tail
+    for (int y0 = 0; y0 < HEIGHT; y0 += 7)
+        BoxBlurRows(src, fixture.light.glow, y0, SDL_min(y0 + 7, HEIGHT), WIDTH, BLUR_RADIUS);
+    for (int y = 0; y < HEIGHT; y++)
+        BoxBlurRow(&src[y * WIDTH], &fixture.light.temp[y * WIDTH], WIDTH, BLUR_RADIUS);
+    int different = 0;
+    for (int i = 0; i < WIDTH * HEIGHT; i++)
+        different += fixture.light.glow[i] != fixture.light.temp[i];
+    SDLTest_AssertCheck(different == 0, "BoxBlurRows matches BoxBlurRow, %d values differ", different);
+    return TEST_COMPLETED;
+}
+
+int TestBoxBlurColumns(void* arg) {
+    float* src = fixture.light.light;
+    FillTestLight(src);
+    for (int x0 = 0; x0 < WIDTH; x0 += BLUR_COLUMNS_PER_JOB)
+        BoxBlurColumns(src, fixture.light.glow, x0, SDL_min(x0 + BLUR_COLUMNS_PER_JOB, WIDTH), HEIGHT, BLUR_RADIUS);
+    for (int x = 0; x < WIDTH; x++)
+        BoxBlurColumnReference(src, fixture.light.temp, x, HEIGHT, BLUR_RADIUS);
+    int different = 0;
+    for (int i = 0; i < WIDTH * HEIGHT; i++)
+        different += fixture.light.glow[i] != fixture.light.temp[i];
+    SDLTest_AssertCheck(different == 0, "BoxBlurColumns matches the per column blur, %d values differ", different);
+    return TEST_COMPLETED;
+}
+
+// Reduced precision stepping may move a ray end by a pixel, no more than
+// PRECISION_TOLERANCE of the lit pixels
+int TestPrecisionTolerance(void* arg) {
+    RenderTestScene(&fixture.pool, fixture.reference, 0, 0, PRECISION_DOUBLE);
+    for (int precision = PRECISION_FLOAT; precision < PRECISION_COUNT; precision++) {
+        int lit;
+        RenderTestScene(&fixture.pool, fixture.surface, 0, 0, precision);
+        int different = CountDifferentPixels(fixture.reference, fixture.surface, 0, &lit);
+        SDLTest_AssertCheck(different <= lit * PRECISION_TOLERANCE, "%s: %d of %d lit pixels differ from double",
+                            precision_names[precision], different, lit);
+    }
+    return TEST_COMPLETED;
+}
+
+// Jobs split the glow pipeline by tiles and columns, the thread count must
+// not show in the image
+int TestThreadCount(void* arg) {
+    struct WorkerPool single;
+    if (!SDLTest_AssertCheck(CreateWorkerPool(&single, 1) == 0, "Single thread pool")) return TEST_ABORTED;
+    RenderTestScene(&single, fixture.reference, 1, 1, PRECISION_DOUBLE);
+    DestroyWorkerPool(&single);
+    RenderTestScene(&fixture.pool, fixture.surface, 1, 1, PRECISION_DOUBLE);
+    int lit;
+    int different = CountDifferentPixels(fixture.reference, fixture.surface, 0, &lit);
+    SDLTest_AssertCheck(different == 0, "%d threads match one thread, %d pixels differ", TEST_THREADS, different);
+    return TEST_COMPLETED;
+}
+
+static const SDLTest_TestCaseReference scene_lines_test = {TestSceneLines, "scene_lines", "Line rays frame", TEST_ENABLED};
+static const SDLTest_TestCaseReference scene_glow_test = {TestSceneGlow, "scene_glow", "Glow frame", TEST_ENABLED};
+static const SDLTest_TestCaseReference scene_area_test = {TestSceneArea, "scene_area", "Area light glow frame", TEST_ENABLED};
+static const SDLTest_TestCaseReference scene_float_test = {TestSceneFloat, "scene_float", "Float stepping frame", TEST_ENABLED};
+static const SDLTest_TestCaseReference scene_fixed_test = {TestSceneFixed, "scene_fixed", "Fixed point stepping frame", TEST_ENABLED};
+static const SDLTest_TestCaseReference fill_rays_test = {TestFillRaysParallel, "fill_rays_parallel", "Parallel rays against FillRays", TEST_ENABLED};
+static const SDLTest_TestCaseReference blur_rows_test = {TestBoxBlurRows, "box_blur_rows", "SSE row blur against scalar", TEST_ENABLED};
+static const SDLTest_TestCaseReference blur_test = {TestBoxBlurColumns, "box_blur_columns", "SSE column blur against scalar", TEST_ENABLED};
+static const SDLTest_TestCaseReference precision_test = {TestPrecisionTolerance, "precision", "Float and fixed against double", TEST_ENABLED};
+static const SDLTest_TestCaseReference threads_test = {TestThreadCount, "thread_count", "Glow on 1 and several threads", TEST_ENABLED};
+
+static const SDLTest_TestCaseReference* scene_tests[] = {
+    &scene_lines_test, &scene_glow_test, &scene_area_test, &scene_float_test, &scene_fixed_test, NULL
+};
+static const SDLTest_TestCaseReference* kernel_tests[] = {
+    &fill_rays_test, &blur_rows_test, &blur_test, &precision_test, &threads_test, NULL
+};
+static SDLTest_TestSuiteReference scene_suite = {"scenes", SetUpTest, scene_tests, TearDownTest};
+static SDLTest_TestSuiteReference kernel_suite = {"kernels", SetUpTest, kernel_tests, TearDownTest};
+static SDLTest_TestSuiteReference* test_suites[] = {&scene_suite, &kernel_suite, NULL};
+
+// RayT [threads] [--bench frames] [--lines] [--area] [--float | --fixed] [--compare-precision]
+//      [--offscreen frames] [--output file.bmp] [--microbench] [--json file] [--kernel name-prefix]
+//      [--test] [--update-golden] [--golden file] [--filter name] [--profile] [--trace file.json]
+//      [--memory-debug]
+struct Options {
+    int thread_count;
+    int bench_frames;
+    int glow;
+    int area_light;
+    int precision;
+    int compare_precision;
+    struct DisplayOptions display;
+    int microbench;
+    char json_path[OUTPUT_PATH_LENGTH];
+    char kernel_filter[64];
+    struct TestOptions test;
+    struct ProfileOptions profile;
+    int memory_debug;
+};
+
+void ParseOptions(int argc, char* argv[], struct Options* options) {
+    options->thread_count = SDL_GetCPUCount();
+    options->bench_frames = 0;
+    options->glow = 1;
+    options->area_light = 0;
+    options->precision = PRECISION_DOUBLE;
+    options->compare_precision = 0;
+    SDL_zero(options->display);
+    options->microbench = 0;
+    SDL_strlcpy(options->json_path, MICROBENCH_JSON, sizeof(options->json_path));
+    options->kernel_filter[0] = 0;
+    SDL_zero(options->test);
+    SDL_zero(options->profile);
+    options->memory_debug = 0;
+
+    struct Arguments arguments;
+    InitArguments(&arguments, argc, argv);
+    for (const char* argument = NextArgument(&arguments); argument; argument = NextArgument(&arguments)) {
+        if (ParseDisplayOption(argument, &arguments, &options->display)) continue;
+        if (ParseTestOption(argument, &arguments, &options->test)) continue;
+        if (ParseProfileOption(argument, &arguments, &options->profile)) continue;
+        if (SDL_strcmp(argument, "--bench") == 0) {
+            const char* frames = NextArgument(&arguments);
+            options->bench_frames = frames ? SDL_atoi(frames) : 0;
+            if (options->bench_frames <= 0) options->bench_frames = 1000;
+        } else if (SDL_strcmp(argument, "--lines") == 0) {
+            options->glow = 0;
+        } else if (SDL_strcmp(argument, "--area") == 0) {
+            options->area_light = 1;
+        } else if (SDL_strcmp(argument, "--float") == 0) {
+            options->precision = PRECISION_FLOAT;
+        } else if (SDL_strcmp(argument, "--fixed") == 0) {
+            options->precision = PRECISION_FIXED;
+        } else if (SDL_strcmp(argument, "--compare-precision") == 0) {
+            options->compare_precision = 1;
+            if (options->bench_frames <= 0) options->bench_frames = 1000;
+        } else if (SDL_strcmp(argument, "--microbench") == 0) {
+            options->microbench = 1;
+        } else if (SDL_strcmp(argument, "--json") == 0) {
+            const char* path = NextArgument(&arguments);
+            if (path) SDL_strlcpy(options->json_path, path, sizeof(options->json_path));
+        } else if (SDL_strcmp(argument, "--kernel") == 0) {
+            const char* name = NextArgument(&arguments);
+            if (name) SDL_strlcpy(options->kernel_filter, name, sizeof(options->kernel_filter));
+        } else if (SDL_strcmp(argument, "--memory-debug") == 0) {
+            options->memory_debug = 1;
+        } else if (SDL_atoi(argument) > 0) {
+            options->thread_count = SDL_atoi(argument);
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+    struct Options options;
+    ParseOptions(argc, argv, &options);
+    if (options.memory_debug) EnableMemoryDebug();
+
+    if (options.test.run) return RunTests(test_suites, &options.test);
+
+    struct WorkerPool pool;
+    struct LightBuffer light = {0};
+    if (CreateWorkerPool(&pool, options.thread_count) != 0 || CreateLightBuffer(&light) != 0) {
+        SDL_Log("Worker or light buffer setup failed: %s", SDL_GetError());
+        DestroyLightBuffer(&light);
+        DestroyWorkerPool(&pool);
         return 1;
     }
+    SDL_Log("Ray casting on %d threads", pool.thread_count);
+
+    if (options.microbench) {
+        int result = RunMicrobenchmarks(&pool, &light, options.json_path, options.kernel_filter);
+        DestroyLightBuffer(&light);
+        DestroyWorkerPool(&pool);
+        return result;
+    }
 
-    SDL_Surface* surface = SDL_GetWindowSurface(window);
-    if (!surface) {
-        MessageBox(NULL, "Failed to load window surface", "Error", MB_OK | MB_ICONERROR);
-        SDL_DestroyWindow(window);
+    if (options.bench_frames > 0) {
+        int result = options.compare_precision
+                   ? ComparePrecision(&pool, &light, options.bench_frames)
+                   : RunBenchmark(&pool, &light, options.bench_frames, options.glow, options.area_light, options.precision);
+        DestroyLightBuffer(&light);
+        DestroyWorkerPool(&pool);
+        return result;
+    }
+
+    struct Display display;
+    SDL_Surface* surface = NULL;
+    if (CreateDisplay(&display, "Raytracing", WIDTH, HEIGHT, 0, &options.display) != 0 || !(surface = GetDisplaySurface(&display))) {
+        SDL_Log("Display setup failed: %s", SDL_GetError());
+        DestroyDisplay(&display);
+        DestroyLightBuffer(&light);
+        DestroyWorkerPool(&pool);
         SDL_Quit();
         return 1;
     }
 
-    struct Circle circle = {200, 200, 40};
-    struct Circle shadow_circle = {600, 300, 140};
-    SDL_Rect erase_rect = (SDL_Rect) {0, 0, WIDTH, HEIGHT};
-    struct Ray rays[RAYS_NUMBER];
-    generate_rays(circle, rays);
-    double obstacle_speed_y = 4;
-    
+    // g toggles the glow, a toggles the area light, p cycles the ray precision
+    static struct Scene scene;
+    InitScene(&scene, options.glow && surface->format->BytesPerPixel == 4, options.area_light);
+    SetPrecision(&scene, options.precision);
+    int thread_count;
+
+    struct FrameLoop loop;
+    InitFrameLoop(&loop, STEP_RATE, DisplayFrameRate(display.window));
+    if (display.offscreen) UseFixedSteps(&loop, 1);
+    InitProfiler(&options.profile);
     int is_running = 1;
     while (is_running) {
         SDL_Event ev;
         while (SDL_PollEvent(&ev)) {
+            if (HandleProfileEvent(&ev)) continue;
             switch(ev.type) {
                 case SDL_MOUSEBUTTONDOWN:
                     printf("mouse\n");
@@ -179,28 +1233,66 @@ int APIENTRY WinMain(HINSTANCE hIsntance, HINSTANCE hPrevInstance, LPSTR lpCmdLi
                     printf("quit\n");
                     is_running = 0;
                     break;
-                case SDL_MOUSEMOTION:
-                    if (ev.motion.state != 0) {
-                        circle.x = ev.motion.x;
-                        circle.y = ev.motion.y;
-                        generate_rays(circle, rays);
+                case SDL_KEYDOWN:
+                    if (ev.key.keysym.sym == SDLK_g) {
+                        scene.glow = !scene.glow && surface->format->BytesPerPixel == 4;
+                        break;
+                    }
+                    if (ev.key.keysym.sym == SDLK_a) {
+                        SetAreaLight(&scene, !scene.area_light);
+                        break;
+                    }
+                    if (ev.key.keysym.sym == SDLK_p) {
+                        SetPrecision(&scene, (scene.precision + 1) % PRECISION_COUNT);
+                        SDL_Log("Ray precision %s", precision_names[scene.precision]);
+                        break;
                     }
+                    // +/- change the thread count at runtime for scaling measurements
+                    if (ev.key.keysym.sym == SDLK_PLUS || ev.key.keysym.sym == SDLK_KP_PLUS || ev.key.keysym.sym == SDLK_EQUALS)
+                        thread_count = SDL_min(pool.thread_count + 1, MAX_THREADS);
+                    else if (ev.key.keysym.sym == SDLK_MINUS || ev.key.keysym.sym == SDLK_KP_MINUS)
+                        thread_count = SDL_max(pool.thread_count - 1, 1);
+                    else
+                        break;
+                    int previous_count = pool.thread_count;
+                    DestroyWorkerPool(&pool);
+                    if (CreateWorkerPool(&pool, thread_count) != 0) {
+                        // back to the count that worked, or give up
+                        SDL_Log("Worker setup on %d threads failed: %s", thread_count, SDL_GetError());
+                        DestroyWorkerPool(&pool);
+                        if (CreateWorkerPool(&pool, previous_count) != 0) {
+                            is_running = 0;
+                            break;
+                        }
+                    }
+                    SDL_Log("Ray casting on %d threads", pool.thread_count);
+                    break;
+                case SDL_MOUSEMOTION:
+                    if (ev.motion.state != 0)
+                        MoveLight(&scene, ev.motion.x, ev.motion.y);
                     break;
             }
             PrintWinEvent(&ev);
         }
+        if (!is_running) break;
 
-        SDL_FillRect(surface, &erase_rect, COLOR_BLACK);
-        FillRays(surface, rays, COLOR_RAY, COLOR_RAY_BLUR, shadow_circle);
-        FillCircle(surface, circle, COLOR_WHITE);
-        FillCircle(surface, shadow_circle, COLOR_WHITE);
-        shadow_circle.y += obstacle_speed_y;
-        if (shadow_circle.y - shadow_circle.radius < 0) obstacle_speed_y = -obstacle_speed_y;
-        if (shadow_circle.y + shadow_circle.radius > HEIGHT) obstacle_speed_y = -obstacle_speed_y;
-        SDL_UpdateWindowSurface(window);
-        SDL_Delay(10);
+        ProfileBegin("simulate");
+        for (int steps = BeginFrame(&loop); steps > 0; steps--)
+            StepScene(&scene);
+        ProfileEnd();
+        RenderScene(&pool, &light, &scene, surface, FrameAlpha(&loop));
+        DrawProfileOverlay(surface);
+        ProfileBegin("present");
+        if (!PresentDisplay(&display)) is_running = 0;
+        ProfileEnd();
+        EndFrame(&loop);
+        ProfileFrame();
     }
 
-    SDL_DestroyWindow(window);
+    ShutdownProfiler();
+    DestroyLightBuffer(&light);
+    DestroyWorkerPool(&pool);
+    DestroyDisplay(&display);
     SDL_Quit();
+    return 0;
 }
@@ -0,0 +1,90 @@
+#include <stdlib.h>
+#include "arena.h"
+#include "SDL_test_memory.h"
+
+static int memory_debug;
+
+static int AllocateArenaBlock(struct Arena* arena, size_t size) {
+    arena->memory = SDL_malloc(size + ARENA_ALIGNMENT);
+    arena->base = (Uint8*) (((uintptr_t) arena->memory + ARENA_ALIGNMENT - 1) & ~(uintptr_t) (ARENA_ALIGNMENT - 1));
+    arena->size = arena->memory ? size : 0;
+    return arena->memory ? 0 : -1;
+}
+
+int CreateArena(struct Arena* arena, const char* name, size_t size) {
+    SDL_zerop(arena);
+    arena->name = name;
+    return AllocateArenaBlock(arena, size);
+}
+
+void DestroyArena(struct Arena* arena) {
+    SDL_free(arena->memory);
+    SDL_zerop(arena);
+}
+
+void ReportArena(const struct Arena* arena) {
+    SDL_Log("Arena %s: high water %zu of %zu bytes", arena->name, SDL_max(arena->high_water, arena->used), arena->size);
+}
+
+void* ArenaAlloc(struct Arena* arena, size_t size) {
+    size_t offset = ArenaSize(arena->used);
+    if (!arena->memory || offset > arena->size || size > arena->size - offset) {
+        arena->demand += ArenaSize(size);
+        return NULL;
+    }
+    arena->used = offset + size;
+    return arena->base + offset;
+}
+
+void* ArenaAllocZeroed(struct Arena* arena, size_t size) {
+    void* block = ArenaAlloc(arena, size);
+    if (block) SDL_memset(block, 0, size);
+    return block;
+}
+
+size_t ArenaSize(size_t size) {
+    return (size + ARENA_ALIGNMENT - 1) & ~(size_t) (ARENA_ALIGNMENT - 1);
+}
+
+// Replaces the block of an empty arena with one holding needed bytes and
+// half again as much, so a slowly growing demand does not reallocate every frame
+static int ReplaceArenaBlock(struct Arena* arena, size_t needed) {
+    SDL_free(arena->memory);
+    if (AllocateArenaBlock(arena, needed + needed / 2) != 0) {
+        SDL_Log("Arena %s: growing to %zu bytes failed", arena->name, needed + needed / 2);
+        return -1;
+    }
+    SDL_Log("Arena %s: grown to %zu bytes", arena->name, arena->size);
+    return 0;
+}
+
+int ResetArena(struct Arena* arena) {
+    size_t needed = ArenaSize(arena->used) + arena->demand;
+    arena->high_water = SDL_max(arena->high_water, needed);
+    if (memory_debug && arena->memory) SDL_memset(arena->base, MEMORY_POISON, arena->used);
+    arena->used = 0;
+    arena->demand = 0;
+    return needed <= arena->size ? 0 : ReplaceArenaBlock(arena, needed);
+}
+
+int GrowArena(struct Arena* arena, size_t size) {
+    if (arena->memory && ArenaSize(arena->used) + size <= arena->size) return 0;
+    SDL_assert(arena->used == 0);
+    if (arena->used != 0) {
+        SDL_Log("Arena %s: cannot grow with %zu bytes allocated", arena->name, arena->used);
+        return -1;
+    }
+    return ReplaceArenaBlock(arena, size);
+}
+
+static void LogAllocations(void) {
+    SDLTest_LogAllocations();
+}
+
+void EnableMemoryDebug(void) {
+    if (memory_debug) return;
+    memory_debug = 1;
+    if (SDLTest_TrackAllocations() != 0) SDL_Log("Allocation tracking unavailable");
+    // after every return from main, SDL_Quit included
+    else atexit(LogAllocations);
+}
@@ -0,0 +1,53 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include "SDL.h"
+
+#define ARENA_ALIGNMENT 64
+// Written over released arena memory with --memory-debug
+#define MEMORY_POISON 0xdd
+
+// Bump allocator over one SDL_malloc block, every allocation
+// ARENA_ALIGNMENT aligned. Nothing is freed on its own, ResetArena releases
+// everything at once, for a frame arena at the end of every frame.
+// Requests that do not fit return NULL and are added to demand; the next
+// reset grows the block to fit them, so after one short frame the arena
+// has its working size and the frame loop never allocates again.
+struct Arena {
+    const char* name;
+    void* memory;
+    Uint8* base;
+    size_t size;
+    size_t used;
+    size_t demand;
+    size_t high_water;
+};
+
+int CreateArena(struct Arena* arena, const char* name, size_t size);
+void DestroyArena(struct Arena* arena);
+// Logs the high-water mark against the size
+void ReportArena(const struct Arena* arena);
+
+// Uninitialized block, NULL once the arena is exhausted
+void* ArenaAlloc(struct Arena* arena, size_t size);
+void* ArenaAllocZeroed(struct Arena* arena, size_t size);
+
+// Arena bytes needed for one allocation, alignment slack included
+size_t ArenaSize(size_t size);
+
+// Releases every allocation and grows the block when the last frame asked
+// for more than it had. Returns -1 when growing failed.
+int ResetArena(struct Arena* arena);
+
+// Makes room for an allocation of size bytes that is known before it is
+// made, within the frame. Growing replaces the block, so the arena must be
+// empty then: asserts nothing is allocated and returns -1 when something is
+// or growing failed.
+int GrowArena(struct Arena* arena, size_t size);
+
+// --memory-debug: tracks every SDL_malloc with SDL_test_memory and logs the
+// allocations still alive at exit and poisons memory released by arenas.
+// Call first thing in main, memory from plain malloc is not tracked.
+void EnableMemoryDebug(void);
+
+#endif
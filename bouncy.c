@@ -1,7 +1,15 @@
 #include <stdio.h>
-#include <windows.h>
+#include <stdlib.h>
+#include <math.h>
 #define SDL_MAIN_HANDLED
 #include "SDL.h"
+#include "frame_loop.h"
+#include "worker_pool.h"
+#include "platform.h"
+#include "microbench.h"
+#include "golden.h"
+#include "profiler.h"
+#include "arena.h"
 
 #define WIDTH 900
 #define HEIGHT 600
@@ -13,7 +21,32 @@
 #define DAMPENING 0.8
 #define BG_COLOR 0x0f0f0f0f
 #define TRAJECTORY_LENGTH 100
+#define MAX_TRAJECTORY_LENGTH 100000
 #define TRAJECTORY_WIDTH 10
+// trail sprites are this much darker at the rim than at the center
+#define TRAIL_RIM_FALLOFF 0.5
+// simulation steps per second, velocities and gravity are per step
+#define STEP_RATE 50
+#define MAX_BALLS 1000000
+// fraction of the window the balls of --balls N cover together
+#define BALL_COVERAGE 0.3
+#define MIN_BALL_RADIUS 1.0
+#define MAX_BALL_RADIUS 10.0
+#define MAX_BALL_SPEED 4.0
+#define BALLS_PER_JOB 4096
+// cells of one color are three apart, so their 3x3 neighbourhoods never overlap
+#define CELL_COLORS 3
+// balls moving further than this many radii per step are substepped
+#define SUBSTEP_FRACTION 1.0
+#define MAX_SUBSTEPS 64
+#define MAX_WALL_BOUNCES 4
+#define MAX_BALL_CONTACTS 4
+// balls simulated by --bench when --balls is not given
+#define BENCH_BALLS 10000
+#define BENCH_JSON "bouncy_bench.json"
+#define MICROBENCH_JSON "bouncy_microbench.json"
+// single circle steps per timed kernel call
+#define MICROBENCH_STEPS 1000
 
 #undef main
 
@@ -45,119 +78,1441 @@ void FillCircle(SDL_Surface* surface, struct Circle circle, Uint32 color) {
     }
 }
 
-void FillTrajectory(SDL_Surface* surface, struct Circle trajectory[TRAJECTORY_LENGTH], int current_trajectory_index) {
-    for (int i = 0; i < current_trajectory_index; i++) {
-        double trajectory_size = TRAJECTORY_WIDTH * (double) i / 100;
-        trajectory[i].radius = trajectory_size;
-        FillCircle(surface, trajectory[i], COLOR_TRAJECTORY);
+// Trajectories of several balls in one circular buffer: every step appends
+// a sample to each trail, overwriting the oldest once full. Sample s of
+// trail t is at s * trail_count + t, so one step writes one contiguous run;
+// the oldest samples are at head. Samples are never moved, and the radius
+// only depends on a sample's age.
+struct Trajectories {
+    int trail_count;
+    int length;
+    int count;
+    int head;
+    double* x;
+    double* y;
+    double* radius;
+};
+
+int CreateTrajectories(struct Trajectories* trajectories, int trail_count, int length) {
+    SDL_zerop(trajectories);
+    trajectories->trail_count = trail_count;
+    trajectories->length = length;
+    // samples are indexed with int
+    if ((size_t) trail_count * length > SDL_MAX_SINT32) return -1;
+    trajectories->x = malloc((size_t) trail_count * length * sizeof(double));
+    trajectories->y = malloc((size_t) trail_count * length * sizeof(double));
+    trajectories->radius = malloc(length * sizeof(double));
+    if (!trajectories->radius || (trail_count > 0 && (!trajectories->x || !trajectories->y))) return -1;
+    // oldest first, growing towards the ball
+    for (int age = 0; age < length; age++)
+        trajectories->radius[age] = TRAJECTORY_WIDTH * (double) age / length;
+    return 0;
+}
+
+void DestroyTrajectories(struct Trajectories* trajectories) {
+    free(trajectories->x);
+    free(trajectories->y);
+    free(trajectories->radius);
+}
+
+// Slot the next sample of every trail goes to
+int NextTrajectorySlot(const struct Trajectories* trajectories) {
+    int slot = trajectories->head + trajectories->count;
+    return slot < trajectories->length ? slot : slot - trajectories->length;
+}
+
+void RecordTrajectory(struct Trajectories* trajectories, int trail, double x, double y) {
+    int sample = NextTrajectorySlot(trajectories) * trajectories->trail_count + trail;
+    trajectories->x[sample] = x;
+    trajectories->y[sample] = y;
+}
+
+// Called once per step after every trail is recorded
+void AdvanceTrajectories(struct Trajectories* trajectories) {
+    if (trajectories->count < trajectories->length) {
+        trajectories->count++;
+    } else if (++trajectories->head == trajectories->length) {
+        trajectories->head = 0;
+    }
+}
+
+void FillTrajectories(SDL_Surface* surface, const struct Trajectories* trajectories) {
+    struct Circle circle = {0};
+    for (int t = 0; t < trajectories->trail_count; t++) {
+        int slot = trajectories->head;
+        for (int age = 0; age < trajectories->count; age++) {
+            circle.x = trajectories->x[slot * trajectories->trail_count + t];
+            circle.y = trajectories->y[slot * trajectories->trail_count + t];
+            circle.radius = trajectories->radius[age];
+            FillCircle(surface, circle, COLOR_TRAJECTORY);
+            if (++slot == trajectories->length) slot = 0;
+        }
+    }
+}
+
+// Moves a ball for time steps, bouncing off the walls at the moment of
+// contact: the rest of the move continues with the damped, reflected
+// velocity instead of being lost to clamping
+void SweepWalls(double* x, double* y, double* v_x, double* v_y, double radius, double time) {
+    for (int bounce = 0; bounce < MAX_WALL_BOUNCES && time > 0; bounce++) {
+        double hit = time;
+        int axis = -1;
+        if (*v_x > 0 && *x + *v_x * time > WIDTH - radius) {
+            hit = (WIDTH - radius - *x) / *v_x;
+            axis = 0;
+        } else if (*v_x < 0 && *x + *v_x * time < radius) {
+            hit = (radius - *x) / *v_x;
+            axis = 0;
+        }
+        if (*v_y > 0 && *y + *v_y * time > HEIGHT - radius && (HEIGHT - radius - *y) / *v_y < hit) {
+            hit = (HEIGHT - radius - *y) / *v_y;
+            axis = 1;
+        } else if (*v_y < 0 && *y + *v_y * time < radius && (radius - *y) / *v_y < hit) {
+            hit = (radius - *y) / *v_y;
+            axis = 1;
+        }
+        // already touching the wall: bounce right away
+        hit = SDL_max(hit, 0);
+        *x += *v_x * hit;
+        *y += *v_y * hit;
+        time -= hit;
+        if (axis == 0) *v_x = -*v_x * DAMPENING;
+        else if (axis == 1) *v_y = -*v_y * DAMPENING;
+        else break;
+    }
+    *x = SDL_clamp(*x, radius, WIDTH - radius);
+    *y = SDL_clamp(*y, radius, HEIGHT - radius);
+}
+
+// How gravity enters a step. Explicit Euler moves with the old velocity,
+// semi-implicit Euler with the new one and velocity Verlet with their mean,
+// which is exact under constant gravity until a bounce.
+enum Integrator {
+    INTEGRATOR_EULER,
+    INTEGRATOR_SEMI_IMPLICIT,
+    INTEGRATOR_VERLET,
+    INTEGRATOR_COUNT
+};
+
+const char* INTEGRATOR_NAMES[INTEGRATOR_COUNT] = {"euler", "semi", "verlet"};
+
+// Share of the gravity kick applied before the move, the rest follows it
+double KickBeforeMove(enum Integrator integrator) {
+    switch (integrator) {
+        case INTEGRATOR_SEMI_IMPLICIT: return 1;
+        case INTEGRATOR_VERLET: return 0.5;
+        default: return 0;
+    }
+}
+
+void step(struct Circle* circle, enum Integrator integrator) {
+    double kick = KickBeforeMove(integrator);
+    circle->v_y += A_GRAVITY * kick;
+    SweepWalls(&circle->x, &circle->y, &circle->v_x, &circle->v_y, circle->radius, 1);
+    circle->v_y += A_GRAVITY * (1 - kick);
+}
+
+// Kinetic plus potential energy per unit mass, zero when resting on the floor
+double BallEnergy(double y, double v_x, double v_y, double radius) {
+    return 0.5 * (v_x * v_x + v_y * v_y) + A_GRAVITY * (HEIGHT - radius - y);
+}
+
+// Circle drawn between two simulation steps, alpha 0 is previous and 1 is current
+struct Circle InterpolateCircle(struct Circle previous, struct Circle current, double alpha) {
+    struct Circle circle = current;
+    circle.x = previous.x * (1 - alpha) + current.x * alpha;
+    circle.y = previous.y * (1 - alpha) + current.y * alpha;
+    return circle;
+}
+
+// Pre-rasterized trail circle: coverage of every pixel of the
+// (2 * radius + 1) square around the center, fading towards the rim
+struct TrailSprite {
+    int radius;
+    int size;
+    Uint8* alpha;
+};
+
+struct TrailSprites {
+    struct TrailSprite sprites[TRAJECTORY_WIDTH + 1];
+};
+
+int CreateTrailSprites(struct TrailSprites* cache) {
+    SDL_zerop(cache);
+    for (int r = 0; r <= TRAJECTORY_WIDTH; r++) {
+        struct TrailSprite* sprite = &cache->sprites[r];
+        sprite->radius = r;
+        sprite->size = 2 * r + 1;
+        sprite->alpha = malloc(sprite->size * sprite->size);
+        if (!sprite->alpha) return -1;
+        for (int y = 0; y < sprite->size; y++) {
+            for (int x = 0; x < sprite->size; x++) {
+                double distance = sqrt((double) (x - r) * (x - r) + (double) (y - r) * (y - r));
+                // one pixel of anti-aliased edge, half brightness at the rim
+                double coverage = SDL_clamp(r - distance + 0.5, 0, 1);
+                double falloff = r > 0 ? 1 - TRAIL_RIM_FALLOFF * SDL_min(distance / r, 1) : 1;
+                sprite->alpha[y * sprite->size + x] = (Uint8) (255 * coverage * falloff + 0.5);
+            }
+        }
     }
+    return 0;
+}
+
+void DestroyTrailSprites(struct TrailSprites* cache) {
+    for (int r = 0; r <= TRAJECTORY_WIDTH; r++)
+        free(cache->sprites[r].alpha);
 }
 
-void step(struct Circle* circle) {
-    circle->x += circle->v_x;
-    circle->y += circle->v_y;
-    circle->v_y += A_GRAVITY;
+// (dst * (255 - alpha) + color * alpha) / 255 per channel, rounded with the
+// x + 128 + (x + 128) / 256 trick so it matches the SSE2 path exactly
+Uint32 BlendPixel(Uint32 dst, Uint32 color, int alpha) {
+    Uint32 result = 0;
+    for (int shift = 0; shift < 32; shift += 8) {
+        int blend = ((dst >> shift) & 0xff) * (255 - alpha) + ((color >> shift) & 0xff) * alpha + 128;
+        result |= (Uint32) ((blend + (blend >> 8)) >> 8) << shift;
+    }
+    return result;
+}
 
-    if (circle->x + circle->radius > WIDTH) {
-        circle->x = WIDTH - circle->radius;
-        circle->v_x = -circle->v_x * DAMPENING;
+// Blends color over a row of 32-bit pixels with per-pixel alpha
+void BlendRow(Uint32* row, const Uint8* alpha, int count, Uint32 color) {
+    int x = 0;
+#ifdef __SSE2__
+    __m128i zero = _mm_setzero_si128();
+    __m128i color_wide = _mm_unpacklo_epi8(_mm_set1_epi32((int) color), zero);
+    __m128i round = _mm_set1_epi16(128);
+    for (; x + 4 <= count; x += 4) {
+        Uint32 alphas;
+        SDL_memcpy(&alphas, &alpha[x], 4);
+        if (!alphas) continue;
+        // every alpha repeated over the four channels of its pixel
+        __m128i a = _mm_unpacklo_epi8(_mm_cvtsi32_si128((int) alphas), zero);
+        a = _mm_unpacklo_epi16(a, a);
+        __m128i a_low = _mm_unpacklo_epi32(a, a);
+        __m128i a_high = _mm_unpackhi_epi32(a, a);
+        __m128i pixels = _mm_loadu_si128((__m128i*) &row[x]);
+        __m128i low = _mm_unpacklo_epi8(pixels, zero);
+        __m128i high = _mm_unpackhi_epi8(pixels, zero);
+        __m128i blend_low = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(low, _mm_sub_epi16(_mm_set1_epi16(255), a_low)), _mm_mullo_epi16(color_wide, a_low)), round);
+        __m128i blend_high = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(high, _mm_sub_epi16(_mm_set1_epi16(255), a_high)), _mm_mullo_epi16(color_wide, a_high)), round);
+        blend_low = _mm_srli_epi16(_mm_add_epi16(blend_low, _mm_srli_epi16(blend_low, 8)), 8);
+        blend_high = _mm_srli_epi16(_mm_add_epi16(blend_high, _mm_srli_epi16(blend_high, 8)), 8);
+        _mm_storeu_si128((__m128i*) &row[x], _mm_packus_epi16(blend_low, blend_high));
     }
-    if (circle->y + circle->radius > HEIGHT) {
-        circle->y = HEIGHT - circle->radius;
-        circle->v_y = -circle->v_y * DAMPENING;
+#endif
+    for (; x < count; x++) {
+        if (alpha[x]) row[x] = BlendPixel(row[x], color, alpha[x]);
+    }
+}
+
+// Blits the sprite centered on (center_x, center_y), clipped to the surface
+void BlendSprite(SDL_Surface* surface, const struct TrailSprite* sprite, int center_x, int center_y, Uint32 color) {
+    int left = center_x - sprite->radius, top = center_y - sprite->radius;
+    int x0 = SDL_max(left, 0), x1 = SDL_min(left + sprite->size, surface->w);
+    int y0 = SDL_max(top, 0), y1 = SDL_min(top + sprite->size, surface->h);
+    for (int y = y0; y < y1; y++) {
+        Uint32* row = (Uint32*) ((Uint8*) surface->pixels + y * surface->pitch);
+        BlendRow(&row[x0], &sprite->alpha[(y - top) * sprite->size + (x0 - left)], x1 - x0, color);
     }
-    if (circle->y - circle->radius < 0) {
-        circle->y = circle->radius;
-        circle->v_y = -circle->v_y * DAMPENING;
+}
+
+// Same samples as FillTrajectories, each stamped from the sprite cache
+void BlendTrajectories(SDL_Surface* surface, const struct Trajectories* trajectories, const struct TrailSprites* cache) {
+    for (int t = 0; t < trajectories->trail_count; t++) {
+        int slot = trajectories->head;
+        for (int age = 0; age < trajectories->count; age++) {
+            int radius = (int) (trajectories->radius[age] + 0.5);
+            if (radius > 0) {
+                BlendSprite(surface, &cache->sprites[radius],
+                            (int) trajectories->x[slot * trajectories->trail_count + t],
+                            (int) trajectories->y[slot * trajectories->trail_count + t], COLOR_TRAJECTORY);
+            }
+            if (++slot == trajectories->length) slot = 0;
+        }
     }
-    if (circle->x - circle->radius < 0) {
-        circle->x = circle->radius;
-        circle->v_x = -circle->v_x * DAMPENING;
+}
+
+// Persistent trail intensity, 16 bits per pixel so slow fades still
+// decay. Every step it is multiplied by decay / 65536 and the newest
+// samples are stamped in; drawing costs the same for any trail length.
+struct TrailLayer {
+    Uint16* intensity;
+    Uint16 decay;
+    Uint8* row_alpha;
+};
+
+int CreateTrailLayer(struct TrailLayer* layer, int length) {
+    layer->intensity = calloc(WIDTH * HEIGHT, sizeof(Uint16));
+    layer->row_alpha = malloc(WIDTH);
+    // a full stamp fades below one alpha step after length steps
+    layer->decay = (Uint16) SDL_min(65536 * pow(1.0 / 255, 1.0 / length), 65535);
+    return layer->intensity && layer->row_alpha ? 0 : -1;
+}
+
+void DestroyTrailLayer(struct TrailLayer* layer) {
+    free(layer->intensity);
+    free(layer->row_alpha);
+}
+
+void DecayTrailLayer(struct TrailLayer* layer) {
+    int i = 0;
+#ifdef __SSE2__
+    __m128i decay = _mm_set1_epi16((short) layer->decay);
+    for (; i + 8 <= WIDTH * HEIGHT; i += 8) {
+        __m128i value = _mm_loadu_si128((__m128i*) &layer->intensity[i]);
+        _mm_storeu_si128((__m128i*) &layer->intensity[i], _mm_mulhi_epu16(value, decay));
     }
+#endif
+    for (; i < WIDTH * HEIGHT; i++)
+        layer->intensity[i] = (Uint16) ((layer->intensity[i] * (Uint32) layer->decay) >> 16);
 }
 
-void UpdateTrajectory(struct Circle trajectory[TRAJECTORY_LENGTH], struct Circle circle, int current_index) {
-    if (current_index >= TRAJECTORY_LENGTH) {
-        // shift array - write the circle at the end of the array
-        for (int i = 0; i < TRAJECTORY_LENGTH - 1; i++) {
-            trajectory[i] = trajectory[i + 1];
+// Keeps the brighter of the layer and the sprite
+void StampTrailLayer(struct TrailLayer* layer, const struct TrailSprite* sprite, int center_x, int center_y) {
+    int left = center_x - sprite->radius, top = center_y - sprite->radius;
+    for (int y = SDL_max(top, 0); y < SDL_min(top + sprite->size, HEIGHT); y++) {
+        for (int x = SDL_max(left, 0); x < SDL_min(left + sprite->size, WIDTH); x++) {
+            Uint16 value = sprite->alpha[(y - top) * sprite->size + (x - left)] * 257;
+            Uint16* pixel = &layer->intensity[y * WIDTH + x];
+            if (value > *pixel) *pixel = value;
+        }
+    }
+}
+
+void BlendTrailLayer(SDL_Surface* surface, struct TrailLayer* layer, Uint32 color) {
+    for (int y = 0; y < HEIGHT; y++) {
+        const Uint16* intensity = &layer->intensity[y * WIDTH];
+        int lit = 0;
+        for (int x = 0; x < WIDTH; x++) {
+            layer->row_alpha[x] = intensity[x] >> 8;
+            lit |= layer->row_alpha[x];
+        }
+        if (!lit) continue;
+        BlendRow((Uint32*) ((Uint8*) surface->pixels + y * surface->pitch), layer->row_alpha, WIDTH, color);
+    }
+}
+
+// Ball system stored as structure of arrays. All balls share one radius and
+// mass; the uniform grid over the window is rebuilt every step by counting
+// sort into buffers allocated once, so the broad phase stays O(n). Balls
+// are reordered by the grid; id and slot map between a ball's slot and its
+// stable id.
+struct Balls {
+    int count;
+    double radius;
+    double* x;
+    double* y;
+    double* v_x;
+    double* v_y;
+    double* previous_x;
+    double* previous_y;
+    double cell_size;
+    int grid_width;
+    int grid_height;
+    int* cell_start;
+    int* cell_balls;
+    int* ball_cell;
+    double* scratch;
+    int* id;
+    int* slot;
+    int* substeps;
+    // fast balls leave their grid cell while they are swept, so they are
+    // kept in per-cell lists that follow them: fast_head per cell, fast_next
+    // per slot, -1 ends a list; ball_cell of a fast ball is its current cell
+    int* fast_head;
+    int* fast_next;
+    enum Integrator integrator;
+    // collision pairs looked at and actually touching, summed over all steps
+    long long pairs_tested;
+    long long pairs_resolved;
+};
+
+Uint32 NextRandom(Uint32* state) {
+    *state = *state * 1664525u + 1013904223u;
+    return *state >> 8;
+}
+
+double RandomUnit(Uint32* state) {
+    return NextRandom(state) / (double) (1 << 24);
+}
+
+// Radius that covers about BALL_COVERAGE of the window with count balls
+double BallRadius(int count) {
+    double radius = sqrt(BALL_COVERAGE * WIDTH * HEIGHT / (M_PI * count));
+    return SDL_clamp(radius, MIN_BALL_RADIUS, MAX_BALL_RADIUS);
+}
+
+int CreateBalls(struct Balls* balls, int count, double radius) {
+    SDL_zerop(balls);
+    balls->count = count;
+    balls->radius = radius;
+    // a cell as wide as a ball: colliding balls always sit in neighbouring cells
+    balls->cell_size = 2 * radius;
+    balls->grid_width = (int) ceil(WIDTH / balls->cell_size);
+    balls->grid_height = (int) ceil(HEIGHT / balls->cell_size);
+    balls->x = malloc(count * sizeof(double));
+    balls->y = malloc(count * sizeof(double));
+    balls->v_x = malloc(count * sizeof(double));
+    balls->v_y = malloc(count * sizeof(double));
+    balls->previous_x = malloc(count * sizeof(double));
+    balls->previous_y = malloc(count * sizeof(double));
+    balls->cell_start = malloc((balls->grid_width * balls->grid_height + 1) * sizeof(int));
+    balls->cell_balls = malloc(count * sizeof(int));
+    balls->ball_cell = malloc(count * sizeof(int));
+    balls->scratch = malloc(count * sizeof(double));
+    balls->id = malloc(count * sizeof(int));
+    balls->slot = malloc(count * sizeof(int));
+    balls->substeps = malloc(count * sizeof(int));
+    balls->fast_head = malloc(balls->grid_width * balls->grid_height * sizeof(int));
+    balls->fast_next = malloc(count * sizeof(int));
+    return balls->x && balls->y && balls->v_x && balls->v_y && balls->previous_x && balls->previous_y
+        && balls->cell_start && balls->cell_balls && balls->ball_cell && balls->scratch && balls->id && balls->slot
+        && balls->substeps && balls->fast_head && balls->fast_next ? 0 : -1;
+}
+
+void DestroyBalls(struct Balls* balls) {
+    free(balls->x);
+    free(balls->y);
+    free(balls->v_x);
+    free(balls->v_y);
+    free(balls->previous_x);
+    free(balls->previous_y);
+    free(balls->cell_start);
+    free(balls->cell_balls);
+    free(balls->ball_cell);
+    free(balls->scratch);
+    free(balls->id);
+    free(balls->slot);
+    free(balls->substeps);
+    free(balls->fast_head);
+    free(balls->fast_next);
+}
+
+// Random positions and velocities, the same for every run
+void ScatterBalls(struct Balls* balls) {
+    Uint32 seed = 1;
+    for (int i = 0; i < balls->count; i++) {
+        balls->x[i] = balls->radius + RandomUnit(&seed) * (WIDTH - 2 * balls->radius);
+        balls->y[i] = balls->radius + RandomUnit(&seed) * (HEIGHT - 2 * balls->radius);
+        balls->v_x[i] = (RandomUnit(&seed) * 2 - 1) * MAX_BALL_SPEED;
+        balls->v_y[i] = (RandomUnit(&seed) * 2 - 1) * MAX_BALL_SPEED;
+        balls->previous_x[i] = balls->x[i];
+        balls->previous_y[i] = balls->y[i];
+        balls->id[i] = i;
+        balls->slot[i] = i;
+        balls->substeps[i] = 1;
+    }
+}
+
+// 1 for the common slow ball; a fast ball gets enough substeps that each
+// moves it at most SUBSTEP_FRACTION radii
+int BallSubsteps(const struct Balls* balls, int i) {
+    double distance = sqrt(balls->v_x[i] * balls->v_x[i] + balls->v_y[i] * balls->v_y[i]);
+    double limit = SUBSTEP_FRACTION * balls->radius;
+    return distance <= limit ? 1 : (int) SDL_min(ceil(distance / limit), MAX_SUBSTEPS);
+}
+
+// Moves the slow balls with the same motion and wall response as step();
+// fast ones only remember where they started and are moved by SweepFastBalls
+void MoveBallsJob(void* context, int index) {
+    struct Balls* balls = context;
+    int end = SDL_min((index + 1) * BALLS_PER_JOB, balls->count);
+    double kick = KickBeforeMove(balls->integrator);
+    for (int i = index * BALLS_PER_JOB; i < end; i++) {
+        balls->previous_x[i] = balls->x[i];
+        balls->previous_y[i] = balls->y[i];
+        if (balls->substeps[i] > 1) continue;
+        balls->v_y[i] += A_GRAVITY * kick;
+        SweepWalls(&balls->x[i], &balls->y[i], &balls->v_x[i], &balls->v_y[i], balls->radius, 1);
+        balls->v_y[i] += A_GRAVITY * (1 - kick);
+    }
+}
+
+int BallCell(const struct Balls* balls, double x, double y) {
+    int cell_x = SDL_clamp((int) (x / balls->cell_size), 0, balls->grid_width - 1);
+    int cell_y = SDL_clamp((int) (y / balls->cell_size), 0, balls->grid_height - 1);
+    return cell_y * balls->grid_width + cell_x;
+}
+
+// Counting sort of the balls by grid cell. The arrays themselves are
+// reordered, so cell c holds balls cell_start[c] .. cell_start[c + 1] - 1
+// and neighbours are close in memory.
+void BuildBallGrid(struct Balls* balls) {
+    int cell_count = balls->grid_width * balls->grid_height;
+    int* start = balls->cell_start;
+    SDL_memset(start, 0, (cell_count + 1) * sizeof(int));
+    for (int i = 0; i < balls->count; i++) {
+        balls->ball_cell[i] = BallCell(balls, balls->x[i], balls->y[i]);
+        start[balls->ball_cell[i] + 1]++;
+    }
+    for (int c = 0; c < cell_count; c++)
+        start[c + 1] += start[c];
+    // cell_balls[k] is the ball moving to slot k
+    for (int i = 0; i < balls->count; i++)
+        balls->cell_balls[start[balls->ball_cell[i]]++] = i;
+    // filling advanced every start to the next cell's, shift back
+    for (int c = cell_count; c > 0; c--)
+        start[c] = start[c - 1];
+    start[0] = 0;
+
+    double* arrays[] = {balls->x, balls->y, balls->v_x, balls->v_y, balls->previous_x, balls->previous_y};
+    for (int a = 0; a < (int) SDL_arraysize(arrays); a++) {
+        for (int k = 0; k < balls->count; k++)
+            balls->scratch[k] = arrays[a][balls->cell_balls[k]];
+        SDL_memcpy(arrays[a], balls->scratch, balls->count * sizeof(double));
+    }
+    // ball_cell is free until it is refilled below
+    int* int_arrays[] = {balls->id, balls->substeps};
+    for (int a = 0; a < (int) SDL_arraysize(int_arrays); a++) {
+        for (int k = 0; k < balls->count; k++)
+            balls->ball_cell[k] = int_arrays[a][balls->cell_balls[k]];
+        SDL_memcpy(int_arrays[a], balls->ball_cell, balls->count * sizeof(int));
+    }
+    for (int k = 0; k < balls->count; k++)
+        balls->slot[balls->id[k]] = k;
+    for (int c = 0; c < cell_count; c++) {
+        for (int k = start[c]; k < start[c + 1]; k++)
+            balls->ball_cell[k] = c;
+    }
+}
+
+// Elastic collision of equal masses along the normal from i to j: the
+// normal components of the velocities are swapped if the balls approach
+void BounceBalls(struct Balls* balls, int i, int j, double n_x, double n_y) {
+    double approach = (balls->v_x[j] - balls->v_x[i]) * n_x + (balls->v_y[j] - balls->v_y[i]) * n_y;
+    if (approach >= 0) return;
+    balls->v_x[i] += approach * n_x;
+    balls->v_y[i] += approach * n_y;
+    balls->v_x[j] -= approach * n_x;
+    balls->v_y[j] -= approach * n_y;
+}
+
+// Returns 1 when the balls overlapped
+int CollideBalls(struct Balls* balls, int i, int j) {
+    double d_x = balls->x[j] - balls->x[i];
+    double d_y = balls->y[j] - balls->y[i];
+    double distance_squared = d_x * d_x + d_y * d_y;
+    double diameter = 2 * balls->radius;
+    if (distance_squared >= diameter * diameter) return 0;
+
+    double distance = sqrt(distance_squared);
+    double n_x = distance > 0 ? d_x / distance : 1;
+    double n_y = distance > 0 ? d_y / distance : 0;
+    double push = (diameter - distance) / 2;
+    balls->x[i] -= n_x * push;
+    balls->y[i] -= n_y * push;
+    balls->x[j] += n_x * push;
+    balls->y[j] += n_y * push;
+    BounceBalls(balls, i, j, n_x, n_y);
+    return 1;
+}
+
+// Earliest t at which ball i moving by (d_x, d_y) touches the resting ball
+// j; 1 or more when it does not within the move
+double ContactTime(const struct Balls* balls, int i, int j, double d_x, double d_y) {
+    double diameter = 2 * balls->radius;
+    // |p + d t| = diameter, p = x[i] - x[j]
+    double a = d_x * d_x + d_y * d_y;
+    double p_x = balls->x[i] - balls->x[j];
+    double p_y = balls->y[i] - balls->y[j];
+    double b = 2 * (p_x * d_x + p_y * d_y);
+    double c = p_x * p_x + p_y * p_y - diameter * diameter;
+    // overlaps are left to the collision pass, receding balls never touch
+    if (a == 0 || c < 0 || b >= 0) return 1;
+    double discriminant = b * b - 4 * a * c;
+    if (discriminant < 0) return 1;
+    return (-b - sqrt(discriminant)) / (2 * a);
+}
+
+void LinkFastBall(struct Balls* balls, int i, int cell) {
+    balls->ball_cell[i] = cell;
+    balls->fast_next[i] = balls->fast_head[cell];
+    balls->fast_head[cell] = i;
+}
+
+void UnlinkFastBall(struct Balls* balls, int i) {
+    int* link = &balls->fast_head[balls->ball_cell[i]];
+    while (*link != i) link = &balls->fast_next[*link];
+    *link = balls->fast_next[i];
+}
+
+// Moves ball i for time steps, stopping at the first touch with another
+// ball (held still meanwhile) to bounce and continue from there. Slow balls
+// are found through the grid, fast ones through the lists of the cells
+// they are in now.
+void SweepBall(struct Balls* balls, int i, double time) {
+    double diameter = 2 * balls->radius;
+    for (int contact = 0; contact < MAX_BALL_CONTACTS && time > 0; contact++) {
+        double d_x = balls->v_x[i] * time;
+        double d_y = balls->v_y[i] * time;
+        // cells of every ball the swept circle can touch
+        int x0 = SDL_max((int) ((SDL_min(balls->x[i], balls->x[i] + d_x) - diameter) / balls->cell_size), 0);
+        int y0 = SDL_max((int) ((SDL_min(balls->y[i], balls->y[i] + d_y) - diameter) / balls->cell_size), 0);
+        int x1 = SDL_min((int) ((SDL_max(balls->x[i], balls->x[i] + d_x) + diameter) / balls->cell_size), balls->grid_width - 1);
+        int y1 = SDL_min((int) ((SDL_max(balls->y[i], balls->y[i] + d_y) + diameter) / balls->cell_size), balls->grid_height - 1);
+
+        double first = 1;
+        int hit = -1;
+        for (int y = y0; y <= y1; y++) {
+            for (int x = x0; x <= x1; x++) {
+                int cell = y * balls->grid_width + x;
+                for (int j = balls->cell_start[cell]; j < balls->cell_start[cell + 1]; j++) {
+                    if (balls->substeps[j] > 1) continue;
+                    balls->pairs_tested++;
+                    double t = ContactTime(balls, i, j, d_x, d_y);
+                    if (t < first) {
+                        first = t;
+                        hit = j;
+                    }
+                }
+                for (int j = balls->fast_head[cell]; j >= 0; j = balls->fast_next[j]) {
+                    balls->pairs_tested++;
+                    double t = j == i ? 1 : ContactTime(balls, i, j, d_x, d_y);
+                    if (t < first) {
+                        first = t;
+                        hit = j;
+                    }
+                }
+            }
+        }
+
+        SweepWalls(&balls->x[i], &balls->y[i], &balls->v_x[i], &balls->v_y[i], balls->radius, first * time);
+        time -= first * time;
+        if (hit < 0) break;
+        balls->pairs_resolved++;
+        double n_x = balls->x[hit] - balls->x[i];
+        double n_y = balls->y[hit] - balls->y[i];
+        double distance = sqrt(n_x * n_x + n_y * n_y);
+        if (distance > 0) BounceBalls(balls, i, hit, n_x / distance, n_y / distance);
+    }
+    int cell = BallCell(balls, balls->x[i], balls->y[i]);
+    if (cell != balls->ball_cell[i]) {
+        UnlinkFastBall(balls, i);
+        LinkFastBall(balls, i, cell);
+    }
+}
+
+// Moves the fast balls serially in slot order, each in substeps of at most
+// SUBSTEP_FRACTION radii so the swept test only needs nearby cells.
+// Returns how many balls were fast.
+int SweepFastBalls(struct Balls* balls) {
+    int fast = 0;
+    SDL_memset(balls->fast_head, -1, balls->grid_width * balls->grid_height * sizeof(int));
+    for (int i = balls->count - 1; i >= 0; i--) {
+        if (balls->substeps[i] > 1) {
+            LinkFastBall(balls, i, balls->ball_cell[i]);
+            fast++;
+        }
+    }
+    double kick = KickBeforeMove(balls->integrator);
+    for (int i = 0; i < balls->count; i++) {
+        int substeps = balls->substeps[i];
+        if (substeps == 1) continue;
+        balls->v_y[i] += A_GRAVITY * kick;
+        for (int s = 0; s < substeps; s++)
+            SweepBall(balls, i, 1.0 / substeps);
+        balls->v_y[i] += A_GRAVITY * (1 - kick);
+    }
+    return fast;
+}
+
+// Collides the balls of one cell with every ball after them in the
+// neighbouring cells, so each pair is handled once. Adds the pairs looked at
+// to tested and returns how many touched.
+int CollideCell(struct Balls* balls, int cell_x, int cell_y, int* tested) {
+    int cell = cell_y * balls->grid_width + cell_x;
+    int resolved = 0;
+    for (int i = balls->cell_start[cell]; i < balls->cell_start[cell + 1]; i++) {
+        for (int y = SDL_max(cell_y - 1, 0); y <= SDL_min(cell_y + 1, balls->grid_height - 1); y++) {
+            for (int x = SDL_max(cell_x - 1, 0); x <= SDL_min(cell_x + 1, balls->grid_width - 1); x++) {
+                int neighbour = y * balls->grid_width + x;
+                int first = SDL_max(balls->cell_start[neighbour], i + 1);
+                *tested += SDL_max(balls->cell_start[neighbour + 1] - first, 0);
+                for (int j = first; j < balls->cell_start[neighbour + 1]; j++)
+                    resolved += CollideBalls(balls, i, j);
+            }
         }
-        trajectory[TRAJECTORY_LENGTH - 1] = circle;
-    } else {
-        trajectory[current_index] = circle;
     }
+    return resolved;
 }
 
-int APIENTRY WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine, int nShowCmd) {
-    HICON hIcon = LoadIcon(hInstance, MAKEINTRESOURCE(IDI_APPLICATION));
-    if (hIcon) {
-        MessageBox(NULL, "Icon loaded successfully!", "Info", MB_OK);
+struct CollisionPass {
+    struct Balls* balls;
+    int color_x;
+    int color_y;
+    SDL_atomic_t tested;
+    SDL_atomic_t resolved;
+};
+
+// One grid row of the current color, every CELL_COLORS-th cell
+void CollideRowJob(void* context, int index) {
+    struct CollisionPass* pass = context;
+    int cell_y = pass->color_y + index * CELL_COLORS;
+    int tested = 0, resolved = 0;
+    for (int cell_x = pass->color_x; cell_x < pass->balls->grid_width; cell_x += CELL_COLORS)
+        resolved += CollideCell(pass->balls, cell_x, cell_y, &tested);
+    SDL_AtomicAdd(&pass->tested, tested);
+    SDL_AtomicAdd(&pass->resolved, resolved);
+}
+
+// Cells are processed one color at a time. Cells of a color touch disjoint
+// balls, and each cell resolves its pairs in a fixed order, so the result is
+// bit-identical for any thread count.
+void StepBalls(struct WorkerPool* pool, struct Balls* balls) {
+    // decided once before anything moves: gravity, walls and bounces change
+    // the velocities, but every ball is moved by exactly one of the passes
+    for (int i = 0; i < balls->count; i++)
+        balls->substeps[i] = BallSubsteps(balls, i);
+    DispatchJobs(pool, MoveBallsJob, balls, (balls->count + BALLS_PER_JOB - 1) / BALLS_PER_JOB);
+    BuildBallGrid(balls);
+    // fast balls moved away from the cells they were sorted into
+    if (SweepFastBalls(balls) > 0) BuildBallGrid(balls);
+    struct CollisionPass pass;
+    SDL_zero(pass);
+    pass.balls = balls;
+    for (pass.color_y = 0; pass.color_y < CELL_COLORS; pass.color_y++) {
+        for (pass.color_x = 0; pass.color_x < CELL_COLORS; pass.color_x++) {
+            int rows = (balls->grid_height - pass.color_y + CELL_COLORS - 1) / CELL_COLORS;
+            DispatchJobs(pool, CollideRowJob, &pass, rows);
+        }
+    }
+    balls->pairs_tested += SDL_AtomicGet(&pass.tested);
+    balls->pairs_resolved += SDL_AtomicGet(&pass.resolved);
+}
+
+// Bytes allocated for the balls and their grid
+size_t BallMemory(const struct Balls* balls) {
+    size_t per_ball = 7 * sizeof(double) + 6 * sizeof(int);
+    return balls->count * per_ball + (2 * balls->grid_width * balls->grid_height + 1) * sizeof(int);
+}
+
+void FillBalls(SDL_Surface* surface, const struct Balls* balls, double alpha, Uint32 color) {
+    struct Circle circle = {0, 0, balls->radius, 0, 0};
+    for (int i = 0; i < balls->count; i++) {
+        circle.x = balls->previous_x[i] * (1 - alpha) + balls->x[i] * alpha;
+        circle.y = balls->previous_y[i] * (1 - alpha) + balls->y[i] * alpha;
+        FillCircle(surface, circle, color);
+    }
+}
+
+double TotalBallEnergy(const struct Balls* balls) {
+    double energy = 0;
+    for (int i = 0; i < balls->count; i++)
+        energy += BallEnergy(balls->y[i], balls->v_x[i], balls->v_y[i], balls->radius);
+    return energy;
+}
+
+// Total energy is sampled after every step and compared with the energy at
+// the last reset; once a second the worst drift and the average cost of a
+// step are logged. Wall bounces and ball collisions lose energy too, so the
+// drift of one integrator is best compared against another on the same run.
+struct EnergyReport {
+    enum Integrator integrator;
+    double initial;
+    double worst_drift;
+    Uint64 step_ticks;
+    int steps;
+};
+
+void ResetEnergyReport(struct EnergyReport* report, enum Integrator integrator, double energy) {
+    SDL_zerop(report);
+    report->integrator = integrator;
+    report->initial = energy;
+}
+
+void ReportEnergy(struct EnergyReport* report, double energy, Uint64 step_ticks) {
+    double drift = energy - report->initial;
+    if (fabs(drift) > fabs(report->worst_drift)) report->worst_drift = drift;
+    report->step_ticks += step_ticks;
+    if (++report->steps < STEP_RATE) return;
+    double relative = report->initial != 0 ? 100 * drift / report->initial : 0;
+    SDL_Log("%s: energy %.2f, drift %+.4f%% (worst %+.2f), %.3f ms/step", INTEGRATOR_NAMES[report->integrator],
+        energy, relative, report->worst_drift, 1000.0 * report->step_ticks / SDL_GetPerformanceFrequency() / report->steps);
+    report->worst_drift = 0;
+    report->step_ticks = 0;
+    report->steps = 0;
+}
+
+// Headless benchmark: runs the ball physics for steps steps without a
+// window, prints throughput and collision statistics and writes them as JSON
+// to json_path. The MD5 of the final positions tells whether an optimization
+// changed the simulation.
+int RunBenchmark(struct WorkerPool* pool, int ball_count, int steps, enum Integrator integrator, const char* json_path) {
+    struct Balls balls;
+    double* step_ms = malloc(steps * sizeof(double));
+    if (CreateBalls(&balls, ball_count, BallRadius(ball_count)) != 0 || !step_ms) {
+        SDL_Log("Benchmark setup failed");
+        DestroyBalls(&balls);
+        free(step_ms);
+        return 1;
+    }
+    ScatterBalls(&balls);
+    balls.integrator = integrator;
+
+    Uint64 frequency = SDL_GetPerformanceFrequency();
+    double total = 0;
+    for (int s = 0; s < steps; s++) {
+        Uint64 start = SDL_GetPerformanceCounter();
+        StepBalls(pool, &balls);
+        step_ms[s] = (SDL_GetPerformanceCounter() - start) * 1000.0 / frequency;
+        total += step_ms[s];
+    }
+
+    SDLTest_Md5Context md5;
+    SDLTest_Md5Init(&md5);
+    SDLTest_Md5Update(&md5, (unsigned char*) balls.x, ball_count * sizeof(double));
+    SDLTest_Md5Update(&md5, (unsigned char*) balls.y, ball_count * sizeof(double));
+    char md5_value[GOLDEN_VALUE_LENGTH];
+    FinishMd5(&md5, md5_value);
+    // without the "md5:" prefix of the golden values
+    const char* md5_text = md5_value + 4;
+
+    double median = Median(step_ms, steps);
+    double p99 = step_ms[(steps * 99 + 99) / 100 - 1];
+    double steps_per_second = steps * 1000.0 / total;
+    size_t memory = BallMemory(&balls);
+    printf("balls %d radius %.2f steps %d threads %d integrator %s\n", ball_count, balls.radius, steps, pool->thread_count, INTEGRATOR_NAMES[integrator]);
+    printf("step ms: min %.3f median %.3f p99 %.3f mean %.3f, %.1f steps/s\n", step_ms[0], median, p99, total / steps, steps_per_second);
+    printf("collision pairs tested %lld resolved %lld (%.1f%%)\n", balls.pairs_tested, balls.pairs_resolved,
+        balls.pairs_tested ? 100.0 * balls.pairs_resolved / balls.pairs_tested : 0);
+    printf("memory %zu bytes\n", memory);
+    printf("md5 %s\n", md5_text);
+
+    int result = 0;
+    FILE* json = fopen(json_path, "w");
+    if (json) {
+        fprintf(json, "{\n");
+        fprintf(json, "  \"balls\": %d,\n  \"radius\": %.4f,\n  \"steps\": %d,\n  \"threads\": %d,\n  \"integrator\": \"%s\",\n",
+            ball_count, balls.radius, steps, pool->thread_count, INTEGRATOR_NAMES[integrator]);
+        fprintf(json, "  \"steps_per_second\": %.3f,\n", steps_per_second);
+        fprintf(json, "  \"step_ms\": {\"min\": %.6f, \"median\": %.6f, \"p99\": %.6f, \"mean\": %.6f},\n", step_ms[0], median, p99, total / steps);
+        fprintf(json, "  \"pairs_tested\": %lld,\n  \"pairs_resolved\": %lld,\n", balls.pairs_tested, balls.pairs_resolved);
+        fprintf(json, "  \"memory_bytes\": %zu,\n  \"md5\": \"%s\"\n}\n", memory, md5_text);
+        fclose(json);
     } else {
-        MessageBox(NULL, "Failed to load icon", "Error", MB_OK | MB_ICONERROR);
+        SDL_Log("Could not write %s", json_path);
+        result = 1;
     }
 
-    char debugMessage[256];
-    snprintf(debugMessage, sizeof(debugMessage), "Command Line arguments: %s\n", lpCmdLine);
-    OutputDebugString(debugMessage);
+    free(step_ms);
+    DestroyBalls(&balls);
+    return result;
+}
+
+// Inputs of the kernels timed by --microbench
+struct KernelInputs {
+    SDL_Surface* surface;
+    struct Circle circle;
+    enum Integrator integrator;
+    struct Trajectories trajectories;
+    struct TrailSprites sprites;
+    struct TrailLayer layer;
+    struct WorkerPool* pool;
+    struct Balls balls;
+};
 
-    if (nShowCmd == SW_SHOWMAXIMIZED) {
-        MessageBox(NULL, "WIndow will be maximized", "Info", MB_OK);
-    } else if (nShowCmd == SW_SHOWMINIMIZED) {
-        MessageBox(NULL, "Window will be minimized", "Info", MB_OK);
+void FillCircleKernel(void* context) {
+    struct KernelInputs* inputs = context;
+    FillCircle(inputs->surface, inputs->circle, COLOR_WHITE);
+}
+
+void StepKernel(void* context) {
+    struct KernelInputs* inputs = context;
+    for (int i = 0; i < MICROBENCH_STEPS; i++)
+        step(&inputs->circle, inputs->integrator);
+}
+
+void FillTrajectoriesKernel(void* context) {
+    struct KernelInputs* inputs = context;
+    FillTrajectories(inputs->surface, &inputs->trajectories);
+}
+
+void BlendTrajectoriesKernel(void* context) {
+    struct KernelInputs* inputs = context;
+    BlendTrajectories(inputs->surface, &inputs->trajectories, &inputs->sprites);
+}
+
+void DecayTrailLayerKernel(void* context) {
+    struct KernelInputs* inputs = context;
+    DecayTrailLayer(&inputs->layer);
+}
+
+void BlendTrailLayerKernel(void* context) {
+    struct KernelInputs* inputs = context;
+    BlendTrailLayer(inputs->surface, &inputs->layer, COLOR_TRAJECTORY);
+}
+
+// every call steps the same scattered balls
+void StepBallsKernel(void* context) {
+    struct KernelInputs* inputs = context;
+    ScatterBalls(&inputs->balls);
+    StepBalls(inputs->pool, &inputs->balls);
+}
+
+void FillBallsKernel(void* context) {
+    struct KernelInputs* inputs = context;
+    FillBalls(inputs->surface, &inputs->balls, 1, COLOR_WHITE);
+}
+
+// Times the drawing and physics kernels, the optimized ones next to the
+// code they replace
+int RunMicrobenchmarks(struct WorkerPool* pool, int ball_count, const char* json_path, const char* filter) {
+    static struct KernelInputs inputs;
+    struct Microbench bench;
+    inputs.pool = pool;
+    inputs.surface = SDL_CreateRGBSurfaceWithFormat(0, WIDTH, HEIGHT, 32, SDL_PIXELFORMAT_XRGB8888);
+    int ok = inputs.surface != NULL;
+    ok = CreateTrajectories(&inputs.trajectories, 1, TRAJECTORY_LENGTH) == 0 && ok;
+    ok = CreateTrailSprites(&inputs.sprites) == 0 && ok;
+    ok = CreateTrailLayer(&inputs.layer, TRAJECTORY_LENGTH) == 0 && ok;
+    ok = CreateBalls(&inputs.balls, ball_count, BallRadius(ball_count)) == 0 && ok;
+    ok = ok && OpenMicrobench(&bench, "bouncy", json_path, filter) == 0;
+    if (ok) {
+        struct Circle large = {WIDTH / 2, HEIGHT / 2, 80, 0, 0};
+        struct Circle small = {WIDTH / 2, HEIGHT / 2, 5, 0, 0};
+        inputs.circle = large;
+        RunMicrobench(&bench, "FillCircle r=80", FillCircleKernel, &inputs, M_PI * 80 * 80, "pixel");
+        inputs.circle = small;
+        RunMicrobench(&bench, "FillCircle r=5", FillCircleKernel, &inputs, M_PI * 5 * 5, "pixel");
+
+        for (int i = 0; i < INTEGRATOR_COUNT; i++) {
+            char name[64];
+            SDL_snprintf(name, sizeof(name), "step %s", INTEGRATOR_NAMES[i]);
+            struct Circle circle = {200, 200, 80, 50, 50};
+            inputs.circle = circle;
+            inputs.integrator = i;
+            RunMicrobench(&bench, name, StepKernel, &inputs, MICROBENCH_STEPS, "step");
+        }
+
+        // one full trail of the default bouncing circle
+        struct Circle circle = {200, 200, 80, 50, 50};
+        for (int i = 0; i < TRAJECTORY_LENGTH; i++) {
+            step(&circle, INTEGRATOR_EULER);
+            RecordTrajectory(&inputs.trajectories, 0, circle.x, circle.y);
+            AdvanceTrajectories(&inputs.trajectories);
+            DecayTrailLayer(&inputs.layer);
+            StampTrailLayer(&inputs.layer, &inputs.sprites.sprites[TRAJECTORY_WIDTH], (int) circle.x, (int) circle.y);
+        }
+        RunMicrobench(&bench, "FillTrajectories", FillTrajectoriesKernel, &inputs, TRAJECTORY_LENGTH, "sample");
+        RunMicrobench(&bench, "BlendTrajectories", BlendTrajectoriesKernel, &inputs, TRAJECTORY_LENGTH, "sample");
+        RunMicrobench(&bench, "DecayTrailLayer", DecayTrailLayerKernel, &inputs, WIDTH * HEIGHT, "pixel");
+        RunMicrobench(&bench, "BlendTrailLayer", BlendTrailLayerKernel, &inputs, WIDTH * HEIGHT, "pixel");
+
+        RunMicrobench(&bench, "StepBalls", StepBallsKernel, &inputs, ball_count, "ball");
+        RunMicrobench(&bench, "FillBalls", FillBallsKernel, &inputs, ball_count, "ball");
+        CloseMicrobench(&bench);
     } else {
-        MessageBox(NULL, "Window will be shown normally", "Info", MB_OK);
+        SDL_Log("Micro-benchmark setup failed");
     }
 
-    if (SDL_Init(SDL_INIT_VIDEO) != 0) {
-        MessageBox(NULL, "SDL Initialization failed", "Error", MB_OK | MB_ICONERROR);
-        return 1;
+    DestroyBalls(&inputs.balls);
+    DestroyTrailLayer(&inputs.layer);
+    DestroyTrailSprites(&inputs.sprites);
+    DestroyTrajectories(&inputs.trajectories);
+    SDL_FreeSurface(inputs.surface);
+    return ok ? 0 : 1;
+}
+
+// Test cases of --test, each gets a fresh fixture from SetUpTest
+#define TEST_THREADS 3
+#define TEST_STEPS 120
+#define TEST_BALLS 2000
+#define TEST_TRAILS 16
+#define TEST_ROW 1027
+
+struct TestFixture {
+    struct WorkerPool pool;
+    SDL_Surface* surface;
+    struct TrailSprites sprites;
+    struct TrailLayer layer;
+    struct Trajectories trajectories;
+    struct Balls balls;
+};
+
+static struct TestFixture fixture;
+
+void SetUpTest(void* arg) {
+    SDL_zero(fixture);
+    int result = CreateWorkerPool(&fixture.pool, TEST_THREADS);
+    result |= CreateTrailSprites(&fixture.sprites) | CreateTrailLayer(&fixture.layer, TRAJECTORY_LENGTH);
+    result |= CreateTrajectories(&fixture.trajectories, TEST_TRAILS, TRAJECTORY_LENGTH);
+    result |= CreateBalls(&fixture.balls, TEST_BALLS, BallRadius(TEST_BALLS));
+    fixture.surface = SDL_CreateRGBSurfaceWithFormat(0, WIDTH, HEIGHT, 32, SDL_PIXELFORMAT_XRGB8888);
+    SDLTest_AssertCheck(result == 0 && fixture.surface, "Test setup");
+}
+
+void TearDownTest(void* arg) {
+    SDL_FreeSurface(fixture.surface);
+    DestroyBalls(&fixture.balls);
+    DestroyTrajectories(&fixture.trajectories);
+    DestroyTrailLayer(&fixture.layer);
+    DestroyTrailSprites(&fixture.sprites);
+    DestroyWorkerPool(&fixture.pool);
+}
+
+// Steps the single circle or the balls TEST_STEPS times recording their
+// trails and draws the last frame the way main does
+void RenderTestScene(int ball_count, int trail_fade) {
+    struct Trajectories* trajectories = &fixture.trajectories;
+    struct Circle circle = {200, 200, 80, 50, 50};
+    int trail_count = ball_count > 0 ? TEST_TRAILS : 1;
+    for (int s = 0; s < TEST_STEPS; s++) {
+        if (ball_count > 0) {
+            StepBalls(&fixture.pool, &fixture.balls);
+            for (int t = 0; t < trail_count; t++)
+                RecordTrajectory(trajectories, t, fixture.balls.x[fixture.balls.slot[t]], fixture.balls.y[fixture.balls.slot[t]]);
+        } else {
+            step(&circle, INTEGRATOR_EULER);
+            for (int t = 0; t < trail_count; t++)
+                RecordTrajectory(trajectories, t, circle.x, circle.y);
+        }
+        AdvanceTrajectories(trajectories);
+        if (trail_fade) {
+            DecayTrailLayer(&fixture.layer);
+            int slot = NextTrajectorySlot(trajectories) - 1;
+            if (slot < 0) slot += trajectories->length;
+            const struct TrailSprite* sprite = &fixture.sprites.sprites[(int) (trajectories->radius[trajectories->count - 1] + 0.5)];
+            for (int t = 0; t < trail_count; t++)
+                StampTrailLayer(&fixture.layer, sprite, (int) trajectories->x[slot * trajectories->trail_count + t], (int) trajectories->y[slot * trajectories->trail_count + t]);
+        }
     }
 
-    SDL_Window* window = SDL_CreateWindow("Bouncy Ball", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, WIDTH, HEIGHT, SDL_WINDOW_BORDERLESS);
-    if (!window) {
-        MessageBox(NULL, "Window creation failed", "Error", MB_OK | MB_ICONERROR);
-        SDL_Quit();
-        return 1;
+    SDL_Rect erase_rect = {0, 0, WIDTH, HEIGHT};
+    SDL_FillRect(fixture.surface, &erase_rect, BG_COLOR);
+    if (trail_fade)
+        BlendTrailLayer(fixture.surface, &fixture.layer, COLOR_TRAJECTORY);
+    else
+        BlendTrajectories(fixture.surface, trajectories, &fixture.sprites);
+    if (ball_count > 0)
+        FillBalls(fixture.surface, &fixture.balls, 1, COLOR_WHITE);
+    else
+        FillCircle(fixture.surface, circle, COLOR_WHITE);
+}
+
+int CheckTestScene(const char* name, int ball_count, int trail_fade) {
+    char md5[GOLDEN_VALUE_LENGTH];
+    if (ball_count > 0) ScatterBalls(&fixture.balls);
+    RenderTestScene(ball_count, trail_fade);
+    SurfaceMd5(fixture.surface, md5);
+    CheckGolden("bouncy", name, md5);
+    return TEST_COMPLETED;
+}
+
+int TestSceneCircle(void* arg) {
+    return CheckTestScene("circle", 0, 0);
+}
+
+int TestSceneCircleFade(void* arg) {
+    return CheckTestScene("circle-fade", 0, 1);
+}
+
+int TestSceneBalls(void* arg) {
+    return CheckTestScene("balls", TEST_BALLS, 0);
+}
+
+// Positions after the benchmark's physics, per integrator
+int TestBallState(void* arg) {
+    for (int integrator = 0; integrator < INTEGRATOR_COUNT; integrator++) {
+        char name[GOLDEN_NAME_LENGTH], crc[GOLDEN_VALUE_LENGTH];
+        ScatterBalls(&fixture.balls);
+        fixture.balls.integrator = integrator;
+        for (int s = 0; s < TEST_STEPS; s++)
+            StepBalls(&fixture.pool, &fixture.balls);
+        SDL_snprintf(name, sizeof(name), "balls-%s-x", INTEGRATOR_NAMES[integrator]);
+        BufferCrc32(fixture.balls.x, TEST_BALLS * sizeof(double), crc);
+        CheckGolden("bouncy", name, crc);
+        SDL_snprintf(name, sizeof(name), "balls-%s-y", INTEGRATOR_NAMES[integrator]);
+        BufferCrc32(fixture.balls.y, TEST_BALLS * sizeof(double), crc);
+        CheckGolden("bouncy", name, crc);
     }
+    return TEST_COMPLETED;
+}
+
+// SSE2 rows against BlendPixel, the row length leaves a scalar tail
+int TestBlendRow(void* arg) {
+    Uint32 row[TEST_ROW], reference[TEST_ROW];
+    Uint8 alpha[TEST_ROW];
+    Uint32 seed = 1;
+    for (int x = 0; x < TEST_ROW; x++) {
+        row[x] = reference[x] = NextRandom(&seed) | NextRandom(&seed) << 24;
+        // runs of transparent pixels take the skip path
+        alpha[x] = (x / 16) % 3 == 0 ? 0 : (x % 7 == 0 ? 255 : NextRandom(&seed));
+    }
+    BlendRow(row, alpha, TEST_ROW, COLOR_TRAJECTORY);
+    for (int x = 0; x < TEST_ROW; x++)
+        if (alpha[x]) reference[x] = BlendPixel(reference[x], COLOR_TRAJECTORY, alpha[x]);
+    int different = 0;
+    for (int x = 0; x < TEST_ROW; x++)
+        different += row[x] != reference[x];
+    SDLTest_AssertCheck(different == 0, "BlendRow matches BlendPixel, %d pixels differ", different);
+    return TEST_COMPLETED;
+}
+
+int TestDecayTrailLayer(void* arg) {
+    Uint16* intensity = fixture.layer.intensity;
+    Uint32 seed = 1;
+    for (int i = 0; i < WIDTH * HEIGHT; i++)
+        intensity[i] = (Uint16) NextRandom(&seed);
+    DecayTrailLayer(&fixture.layer);
+    seed = 1;
+    int different = 0;
+    for (int i = 0; i < WIDTH * HEIGHT; i++) {
+        Uint16 value = (Uint16) NextRandom(&seed);
+        different += intensity[i] != (Uint16) ((value * (Uint32) fixture.layer.decay) >> 16);
+    }
+    SDLTest_AssertCheck(different == 0, "DecayTrailLayer matches the scalar decay, %d pixels differ", different);
+    return TEST_COMPLETED;
+}
+
+// StepBalls promises the same result for any thread count
+int TestStepBallsThreads(void* arg) {
+    struct WorkerPool single;
+    struct Balls reference;
+    if (!SDLTest_AssertCheck(CreateWorkerPool(&single, 1) == 0 && CreateBalls(&reference, TEST_BALLS, BallRadius(TEST_BALLS)) == 0, "Reference setup")) {
+        DestroyWorkerPool(&single);
+        DestroyBalls(&reference);
+        return TEST_ABORTED;
+    }
+    ScatterBalls(&reference);
+    ScatterBalls(&fixture.balls);
+    for (int s = 0; s < TEST_STEPS; s++) {
+        StepBalls(&single, &reference);
+        StepBalls(&fixture.pool, &fixture.balls);
+    }
+    SDLTest_AssertCheck(SDL_memcmp(reference.x, fixture.balls.x, TEST_BALLS * sizeof(double)) == 0
+                     && SDL_memcmp(reference.y, fixture.balls.y, TEST_BALLS * sizeof(double)) == 0
+                     && reference.pairs_resolved == fixture.balls.pairs_resolved,
+                        "%d threads match one thread", TEST_THREADS);
+    DestroyBalls(&reference);
+    DestroyWorkerPool(&single);
+    return TEST_COMPLETED;
+}
+
+// A slow ball that turns fast during its step is still moved only once, like
+// the single circle of step()
+int TestBallSubsteps(void* arg) {
+    struct Balls balls;
+    if (!SDLTest_AssertCheck(CreateBalls(&balls, 1, 5) == 0, "Ball allocation")) {
+        DestroyBalls(&balls);
+        return TEST_ABORTED;
+    }
+    ScatterBalls(&balls);
+    struct Circle circle = {300, 300, 5, 0, SUBSTEP_FRACTION * 5 - 0.1};
+    balls.x[0] = circle.x;
+    balls.y[0] = circle.y;
+    balls.v_x[0] = circle.v_x;
+    balls.v_y[0] = circle.v_y;
+    StepBalls(&fixture.pool, &balls);
+    step(&circle, balls.integrator);
+    SDLTest_AssertCheck(balls.y[0] == circle.y && balls.v_y[0] == circle.v_y, "y=%.3f v_y=%.3f, step() gives y=%.3f v_y=%.3f",
+                        balls.y[0], balls.v_y[0], circle.y, circle.v_y);
+    DestroyBalls(&balls);
+    return TEST_COMPLETED;
+}
 
-    SDL_Surface* surface = SDL_GetWindowSurface(window);
-    if (!surface) {
-        MessageBox(NULL, "Failed to get window surface", "Error", MB_OK | MB_ICONERROR);
-        SDL_DestroyWindow(window);
+// Two fast balls head on: the second one swept must meet the first where
+// that one ended its sweep, not pass through it
+int TestFastBallsCollide(void* arg) {
+    struct Balls balls;
+    if (!SDLTest_AssertCheck(CreateBalls(&balls, 2, 5) == 0, "Ball allocation")) {
+        DestroyBalls(&balls);
+        return TEST_ABORTED;
+    }
+    ScatterBalls(&balls);
+    double start_x[2] = {100, 250}, v_x[2] = {50, -120};
+    for (int i = 0; i < 2; i++) {
+        balls.x[i] = start_x[i];
+        balls.y[i] = 300;
+        balls.v_x[i] = v_x[i];
+        balls.v_y[i] = 0;
+    }
+    StepBalls(&fixture.pool, &balls);
+    int left = balls.slot[0], right = balls.slot[1];
+    SDLTest_AssertCheck(balls.pairs_resolved > 0, "The balls touched");
+    SDLTest_AssertCheck(balls.x[left] < balls.x[right], "Ball 0 at x=%.3f stays left of ball 1 at x=%.3f", balls.x[left], balls.x[right]);
+    SDLTest_AssertCheck(balls.v_x[left] < 0 && balls.v_x[right] > 0, "Velocities %.3f and %.3f point apart", balls.v_x[left], balls.v_x[right]);
+    DestroyBalls(&balls);
+    return TEST_COMPLETED;
+}
+
+static const SDLTest_TestCaseReference scene_circle_test = {TestSceneCircle, "scene_circle", "Circle with sprite trail", TEST_ENABLED};
+static const SDLTest_TestCaseReference scene_fade_test = {TestSceneCircleFade, "scene_circle_fade", "Circle with fading trail", TEST_ENABLED};
+static const SDLTest_TestCaseReference scene_balls_test = {TestSceneBalls, "scene_balls", "Colliding balls with trails", TEST_ENABLED};
+static const SDLTest_TestCaseReference ball_state_test = {TestBallState, "ball_state", "Ball positions per integrator", TEST_ENABLED};
+static const SDLTest_TestCaseReference blend_row_test = {TestBlendRow, "blend_row", "SSE2 blend against BlendPixel", TEST_ENABLED};
+static const SDLTest_TestCaseReference decay_test = {TestDecayTrailLayer, "decay_trail_layer", "SSE2 decay against scalar", TEST_ENABLED};
+static const SDLTest_TestCaseReference threads_test = {TestStepBallsThreads, "step_balls_threads", "Physics on 1 and several threads", TEST_ENABLED};
+static const SDLTest_TestCaseReference substeps_test = {TestBallSubsteps, "ball_substeps", "Ball turning fast is moved once", TEST_ENABLED};
+static const SDLTest_TestCaseReference fast_balls_test = {TestFastBallsCollide, "fast_balls_collide", "Two fast balls on a collision course", TEST_ENABLED};
+
+static const SDLTest_TestCaseReference* scene_tests[] = {
+    &scene_circle_test, &scene_fade_test, &scene_balls_test, &ball_state_test, NULL
+};
+static const SDLTest_TestCaseReference* kernel_tests[] = {
+    &blend_row_test, &decay_test, &threads_test, &substeps_test, &fast_balls_test, NULL
+};
+static SDLTest_TestSuiteReference scene_suite = {"scenes", SetUpTest, scene_tests, TearDownTest};
+static SDLTest_TestSuiteReference kernel_suite = {"kernels", SetUpTest, kernel_tests, TearDownTest};
+static SDLTest_TestSuiteReference* test_suites[] = {&scene_suite, &kernel_suite, NULL};
+
+struct Options {
+    int ball_count;
+    int thread_count;
+    int trail_count;
+    int trail_length;
+    int trail_fade;
+    enum Integrator integrator;
+    int energy;
+    int bench_steps;
+    int microbench;
+    char json_path[260];
+    char kernel_filter[64];
+    struct DisplayOptions display;
+    struct TestOptions test;
+    struct ProfileOptions profile;
+    int memory_debug;
+};
+
+// bouncy [--balls N] [--threads N] [--trails N] [--trail-length N] [--trail-fade]
+//        [--integrator euler|semi|verlet] [--energy] [--bench steps] [--json file]
+//        [--microbench] [--kernel name-prefix]
+//        [--offscreen frames] [--output file.bmp]
+//        [--test] [--update-golden] [--golden file] [--filter name]
+//        [--profile] [--trace file.json] [--memory-debug]
+void ParseOptions(int argc, char* argv[], struct Options* options) {
+    options->ball_count = 0;
+    options->thread_count = SDL_GetCPUCount();
+    options->trail_count = 1;
+    options->trail_length = TRAJECTORY_LENGTH;
+    options->trail_fade = 0;
+    options->integrator = INTEGRATOR_EULER;
+    options->energy = 0;
+    options->bench_steps = 0;
+    options->microbench = 0;
+    options->json_path[0] = 0;
+    options->kernel_filter[0] = 0;
+    SDL_zero(options->display);
+    SDL_zero(options->test);
+    SDL_zero(options->profile);
+    options->memory_debug = 0;
+
+    struct Arguments arguments;
+    InitArguments(&arguments, argc, argv);
+    for (const char* argument = NextArgument(&arguments); argument; argument = NextArgument(&arguments)) {
+        if (ParseDisplayOption(argument, &arguments, &options->display)) continue;
+        if (ParseTestOption(argument, &arguments, &options->test)) continue;
+        if (ParseProfileOption(argument, &arguments, &options->profile)) continue;
+        if (SDL_strcmp(argument, "--balls") == 0) {
+            const char* balls = NextArgument(&arguments);
+            options->ball_count = SDL_clamp(balls ? SDL_atoi(balls) : 0, 0, MAX_BALLS);
+        } else if (SDL_strcmp(argument, "--threads") == 0) {
+            const char* threads = NextArgument(&arguments);
+            options->thread_count = SDL_clamp(threads ? SDL_atoi(threads) : 1, 1, MAX_THREADS);
+        } else if (SDL_strcmp(argument, "--trails") == 0) {
+            const char* trails = NextArgument(&arguments);
+            options->trail_count = SDL_max(trails ? SDL_atoi(trails) : 1, 0);
+        } else if (SDL_strcmp(argument, "--trail-length") == 0) {
+            const char* length = NextArgument(&arguments);
+            options->trail_length = SDL_clamp(length ? SDL_atoi(length) : TRAJECTORY_LENGTH, 1, MAX_TRAJECTORY_LENGTH);
+        } else if (SDL_strcmp(argument, "--trail-fade") == 0) {
+            options->trail_fade = 1;
+        } else if (SDL_strcmp(argument, "--integrator") == 0) {
+            const char* name = NextArgument(&arguments);
+            for (int i = 0; name && i < INTEGRATOR_COUNT; i++)
+                if (SDL_strcmp(name, INTEGRATOR_NAMES[i]) == 0) options->integrator = i;
+        } else if (SDL_strcmp(argument, "--energy") == 0) {
+            options->energy = 1;
+        } else if (SDL_strcmp(argument, "--bench") == 0) {
+            const char* steps = NextArgument(&arguments);
+            options->bench_steps = steps ? SDL_atoi(steps) : 0;
+            if (options->bench_steps <= 0) options->bench_steps = 1000;
+        } else if (SDL_strcmp(argument, "--json") == 0) {
+            const char* path = NextArgument(&arguments);
+            if (path) SDL_strlcpy(options->json_path, path, sizeof(options->json_path));
+        } else if (SDL_strcmp(argument, "--microbench") == 0) {
+            options->microbench = 1;
+        } else if (SDL_strcmp(argument, "--kernel") == 0) {
+            const char* name = NextArgument(&arguments);
+            if (name) SDL_strlcpy(options->kernel_filter, name, sizeof(options->kernel_filter));
+        } else if (SDL_strcmp(argument, "--memory-debug") == 0) {
+            options->memory_debug = 1;
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+    // --balls N swaps the single circle for N colliding balls; trails then
+    // follow the first --trails of them
+    for (int i = 1; i < argc; i++) SDL_Log("Command line argument %d: %s", i, argv[i]);
+    struct Options options;
+    ParseOptions(argc, argv, &options);
+    if (options.memory_debug) EnableMemoryDebug();
+    if (options.test.run) return RunTests(test_suites, &options.test);
+
+    // --bench and --microbench run headless, without a display
+    if (options.bench_steps > 0 || options.microbench) {
+        struct WorkerPool pool;
+        SDL_zero(pool);
+        if (CreateWorkerPool(&pool, options.thread_count) != 0) {
+            SDL_Log("Worker setup failed");
+            DestroyWorkerPool(&pool);
+            return 1;
+        }
+        int bench_balls = options.ball_count > 0 ? options.ball_count : BENCH_BALLS;
+        int result = options.microbench
+                   ? RunMicrobenchmarks(&pool, bench_balls, options.json_path[0] ? options.json_path : MICROBENCH_JSON, options.kernel_filter)
+                   : RunBenchmark(&pool, bench_balls, options.bench_steps, options.integrator, options.json_path[0] ? options.json_path : BENCH_JSON);
+        DestroyWorkerPool(&pool);
+        return result;
+    }
+
+    struct Display display;
+    SDL_Surface* surface = NULL;
+    if (CreateDisplay(&display, "Bouncy Ball", WIDTH, HEIGHT, SDL_WINDOW_BORDERLESS, &options.display) != 0 || !(surface = GetDisplaySurface(&display))) {
+        SDL_Log("Display setup failed: %s", SDL_GetError());
+        DestroyDisplay(&display);
         SDL_Quit();
         return 1;
     }
 
+    int ball_count = options.ball_count;
+    struct Balls balls;
+    struct WorkerPool pool;
+    SDL_zero(pool);
+    if (ball_count > 0) {
+        if (CreateBalls(&balls, ball_count, BallRadius(ball_count)) != 0 || CreateWorkerPool(&pool, options.thread_count) != 0) {
+            SDL_Log("Ball or worker setup failed");
+            DestroyBalls(&balls);
+            DestroyWorkerPool(&pool);
+            DestroyDisplay(&display);
+            SDL_Quit();
+            return 1;
+        }
+        ScatterBalls(&balls);
+        balls.integrator = options.integrator;
+    }
+
     struct Circle circle = {200, 200, 80, 50, 50};
-    struct Circle trajectory[TRAJECTORY_LENGTH];
-    int current_trajectory_index = 0;
+    struct Circle previous_circle = circle;
+    int trail_count = SDL_min(options.trail_count, ball_count > 0 ? ball_count : 1);
+    // 32-bit surfaces blend the trails from cached sprites; --trail-fade
+    // keeps a decaying trail layer instead of redrawing every sample
+    int blend_trails = surface->format->BytesPerPixel == 4;
+    int trail_fade = blend_trails && options.trail_fade;
+    struct Trajectories trajectories;
+    struct TrailSprites trail_sprites = {0};
+    struct TrailLayer trail_layer = {0};
+    if (CreateTrajectories(&trajectories, trail_count, options.trail_length) != 0
+        || (blend_trails && CreateTrailSprites(&trail_sprites) != 0)
+        || (trail_fade && CreateTrailLayer(&trail_layer, options.trail_length) != 0)) {
+        SDL_Log("Trajectory allocation failed");
+        DestroyTrajectories(&trajectories);
+        DestroyTrailSprites(&trail_sprites);
+        DestroyTrailLayer(&trail_layer);
+        if (ball_count > 0) {
+            DestroyBalls(&balls);
+            DestroyWorkerPool(&pool);
+        }
+        DestroyDisplay(&display);
+        SDL_Quit();
+        return 1;
+    }
 
     SDL_Rect erase_rect = {0, 0, WIDTH, HEIGHT};
     SDL_Event event;
+    struct FrameLoop loop;
+    InitFrameLoop(&loop, STEP_RATE, DisplayFrameRate(display.window));
+    if (display.offscreen) UseFixedSteps(&loop, 1);
+    // i cycles the integrator; --energy logs how well each keeps the energy
+    enum Integrator integrator = options.integrator;
+    struct EnergyReport energy_report;
+    ResetEnergyReport(&energy_report, integrator, ball_count > 0 ? TotalBallEnergy(&balls)
+        : BallEnergy(circle.y, circle.v_x, circle.v_y, circle.radius));
+    InitProfiler(&options.profile);
     int simulation_running = 1;
     while (simulation_running) {
         while (SDL_PollEvent(&event)) {
+            if (HandleProfileEvent(&event)) continue;
             if (event.type == SDL_QUIT) 
                 simulation_running = 0;
             if (event.type == SDL_KEYDOWN) {
                 if (event.key.keysym.sym == SDLK_SPACE) {
                     simulation_running = 0;
+                } else if (event.key.keysym.sym == SDLK_i) {
+                    integrator = (integrator + 1) % INTEGRATOR_COUNT;
+                    balls.integrator = integrator;
+                    ResetEnergyReport(&energy_report, integrator, ball_count > 0 ? TotalBallEnergy(&balls)
+                        : BallEnergy(circle.y, circle.v_x, circle.v_y, circle.radius));
+                    SDL_Log("integrator: %s", INTEGRATOR_NAMES[integrator]);
                 }
             }
         }
 
+        ProfileBegin("simulate");
+        for (int steps = BeginFrame(&loop); steps > 0; steps--) {
+            Uint64 step_start = SDL_GetPerformanceCounter();
+            if (ball_count > 0) {
+                StepBalls(&pool, &balls);
+                if (options.energy) ReportEnergy(&energy_report, TotalBallEnergy(&balls), SDL_GetPerformanceCounter() - step_start);
+                for (int t = 0; t < trail_count; t++)
+                    RecordTrajectory(&trajectories, t, balls.x[balls.slot[t]], balls.y[balls.slot[t]]);
+            } else {
+                previous_circle = circle;
+                step(&circle, integrator);
+                if (options.energy) ReportEnergy(&energy_report, BallEnergy(circle.y, circle.v_x, circle.v_y, circle.radius),
+                    SDL_GetPerformanceCounter() - step_start);
+                if (trail_count > 0) RecordTrajectory(&trajectories, 0, circle.x, circle.y);
+            }
+            AdvanceTrajectories(&trajectories);
+            if (trail_fade) {
+                DecayTrailLayer(&trail_layer);
+                int newest = trajectories.count - 1;
+                int slot = NextTrajectorySlot(&trajectories) - 1;
+                if (slot < 0) slot += trajectories.length;
+                const struct TrailSprite* sprite = &trail_sprites.sprites[(int) (trajectories.radius[newest] + 0.5)];
+                for (int t = 0; t < trail_count; t++) {
+                    StampTrailLayer(&trail_layer, sprite, (int) trajectories.x[slot * trail_count + t], (int) trajectories.y[slot * trail_count + t]);
+                }
+            }
+        }
+        ProfileEnd();
+
+        ProfileBegin("clear");
         SDL_FillRect(surface, &erase_rect, BG_COLOR);
-        FillTrajectory(surface, trajectory, current_trajectory_index);
-        FillCircle(surface, circle, COLOR_WHITE);
-        step(&circle);
-        UpdateTrajectory(trajectory, circle, current_trajectory_index);
-        if (current_trajectory_index < TRAJECTORY_LENGTH) 
-            ++current_trajectory_index;
-        SDL_UpdateWindowSurface(window);
-        SDL_Delay(20);
+        ProfileEnd();
+        ProfileBegin("rasterize");
+        if (blend_trails) {
+            if (SDL_MUSTLOCK(surface)) SDL_LockSurface(surface);
+            if (trail_fade)
+                BlendTrailLayer(surface, &trail_layer, COLOR_TRAJECTORY);
+            else
+                BlendTrajectories(surface, &trajectories, &trail_sprites);
+            if (SDL_MUSTLOCK(surface)) SDL_UnlockSurface(surface);
+        } else {
+            FillTrajectories(surface, &trajectories);
+        }
+        if (ball_count > 0)
+            FillBalls(surface, &balls, FrameAlpha(&loop), COLOR_WHITE);
+        else
+            FillCircle(surface, InterpolateCircle(previous_circle, circle, FrameAlpha(&loop)), COLOR_WHITE);
+        ProfileEnd();
+        DrawProfileOverlay(surface);
+        ProfileBegin("present");
+        if (!PresentDisplay(&display)) simulation_running = 0;
+        ProfileEnd();
+        EndFrame(&loop);
+        ProfileFrame();
     }  
 
-    SDL_DestroyWindow(window);
+    ShutdownProfiler();
+    DestroyTrajectories(&trajectories);
+    DestroyTrailSprites(&trail_sprites);
+    DestroyTrailLayer(&trail_layer);
+    if (ball_count > 0) {
+        DestroyBalls(&balls);
+        DestroyWorkerPool(&pool);
+    }
+    DestroyDisplay(&display);
     SDL_Quit();
 
     return 0;
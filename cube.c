@@ -1,8 +1,15 @@
 #include <stdio.h>
-#include <windows.h>
+#include <stdlib.h>
 #include <math.h>
-#define SDL_MAIN_HADNLED
+#define SDL_MAIN_HANDLED
 #include "SDL.h"
+#include "worker_pool.h"
+#include "frame_loop.h"
+#include "platform.h"
+#include "microbench.h"
+#include "golden.h"
+#include "profiler.h"
+#include "arena.h"
 
 #define WIDTH 900
 #define HEIGHT 600
@@ -11,6 +18,45 @@
 #define POINT_SIZE 5
 #define COORDINATE_SYSTEM_OFFSET_X WIDTH / 2
 #define COORDINATE_SYSTEM_OFFSET_Y HEIGHT / 2
+#define CAMERA_DISTANCE 500
+#define FOCAL_LENGTH 500
+#define NEAR_PLANE 10
+#define FAR_PLANE 5000
+#define CUBE_SIDE_LENGTH 200
+#define OBJ_RADIUS 160
+#define COLOR_EDGE 0xffffffff
+#define COLOR_MESH 0x4fa3ff
+#define RASTER_TILE_SIZE 64
+#define RASTER_BLOCK_SIZE 8
+#define RASTER_TILES_X ((WIDTH + RASTER_TILE_SIZE - 1) / RASTER_TILE_SIZE)
+#define RASTER_TILES_Y ((HEIGHT + RASTER_TILE_SIZE - 1) / RASTER_TILE_SIZE)
+// bin entries reserved for large triangles, in whole screens of tiles
+#define FRAME_SCREEN_BINS 16
+#define AMBIENT_LIGHT 0.15f
+// unit vector the light travels along, from the upper left behind the camera
+#define LIGHT_DIRECTION_X 0.408f
+#define LIGHT_DIRECTION_Y 0.408f
+#define LIGHT_DIRECTION_Z 0.816f
+// Point cloud arrays are padded to a whole number of AVX registers
+#define CLOUD_LANES 8
+#define DEFAULT_POINTS 1200
+#define MIN_POINTS 1000
+#define MAX_POINTS 10000000
+#define MODEL_PATH_LENGTH 260
+#define THROUGHPUT_FRAMES 100
+// rotation steps per second, independent of the frame rate
+#define STEP_RATE 50
+#define MICROBENCH_JSON "cube_microbench.json"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#if defined(__GNUC__) || defined(__clang__)
+#define TARGET_AVX __attribute__((target("avx")))
+#else
+#define TARGET_AVX
+#endif
+#endif
 
 #undef main
 
@@ -20,6 +66,53 @@ struct Point {
     double z;
 };
 
+// Structure of arrays point cloud, each array SIMD aligned and padded to CLOUD_LANES
+struct PointCloud {
+    float* x;
+    float* y;
+    float* z;
+    int count;
+    int capacity;
+};
+
+struct Options {
+    int point_count;
+    char model_path[MODEL_PATH_LENGTH];
+    struct DisplayOptions display;
+    int microbench;
+    char json_path[OUTPUT_PATH_LENGTH];
+    char kernel_filter[64];
+    struct TestOptions test;
+    struct ProfileOptions profile;
+    int memory_debug;
+};
+
+// Pinhole camera on the -z axis looking at the origin, distances in model units
+struct Camera {
+    double distance;
+    double focal_length;
+    double near;
+    double far;
+};
+
+// Indexed mesh: only the vertices are transformed, edges and triangles refer
+// to them by index
+struct Mesh {
+    struct PointCloud vertices;
+    struct PointCloud normals;
+    int* edges;
+    int edge_count;
+    int* triangles;
+    int triangle_count;
+};
+
+// View space z per pixel, cleared to the far plane every frame
+struct DepthBuffer {
+    float* depth;
+    int width;
+    int height;
+};
+
 int draw_point(SDL_Surface* surface, int x, int y) {
     SDL_Rect rect = (SDL_Rect) {x, y, POINT_SIZE, POINT_SIZE};
     SDL_FillRect(surface, &rect, COLOR_WHITE);
@@ -39,8 +132,71 @@ int draw_points_3d(SDL_Surface* surface, struct Point points[], int number_of_po
     }
 }
 
+void build_rotation_matrix(double alpha, double beta, double gamma, double rotation_matrix[3][3]) {
+    double sa = sin(alpha), ca = cos(alpha);
+    double sb = sin(beta), cb = cos(beta);
+    double sg = sin(gamma), cg = cos(gamma);
+    rotation_matrix[0][0] = ca * cb;
+    rotation_matrix[0][1] = ca * sb * sg - sa * cg;
+    rotation_matrix[0][2] = ca * sb * cg + sa * sg;
+    rotation_matrix[1][0] = sa * cb;
+    rotation_matrix[1][1] = sa * sb * sg + ca * cg;
+    rotation_matrix[1][2] = sa * sb * cg - ca * sg;
+    rotation_matrix[2][0] = -sb;
+    rotation_matrix[2][1] = cb * sg;
+    rotation_matrix[2][2] = cb * cg;
+}
+
+struct Quaternion {
+    double w, x, y, z;
+};
+
+struct Quaternion quaternion_multiply(struct Quaternion a, struct Quaternion b) {
+    return (struct Quaternion) {
+        a.w * b.w - a.x * b.x - a.y * b.y - a.z * b.z,
+        a.w * b.x + a.x * b.w + a.y * b.z - a.z * b.y,
+        a.w * b.y - a.x * b.z + a.y * b.w + a.z * b.x,
+        a.w * b.z + a.x * b.y - a.y * b.x + a.z * b.w
+    };
+}
+
+struct Quaternion quaternion_normalize(struct Quaternion q) {
+    double length = sqrt(q.w * q.w + q.x * q.x + q.y * q.y + q.z * q.z);
+    return (struct Quaternion) {q.w / length, q.x / length, q.y / length, q.z / length};
+}
+
+// Same rotation as build_rotation_matrix: z by alpha, then y by beta, then x by gamma
+struct Quaternion quaternion_from_euler(double alpha, double beta, double gamma) {
+    struct Quaternion z = {cos(alpha / 2), 0, 0, sin(alpha / 2)};
+    struct Quaternion y = {cos(beta / 2), 0, sin(beta / 2), 0};
+    struct Quaternion x = {cos(gamma / 2), sin(gamma / 2), 0, 0};
+    return quaternion_multiply(quaternion_multiply(z, y), x);
+}
+
+// Normalized linear blend along the shorter arc, close enough to a slerp
+// between the orientations of two neighbouring steps
+struct Quaternion quaternion_nlerp(struct Quaternion a, struct Quaternion b, double t) {
+    double sign = a.w * b.w + a.x * b.x + a.y * b.y + a.z * b.z < 0 ? -1 : 1;
+    return quaternion_normalize((struct Quaternion) {
+        a.w * (1 - t) + sign * b.w * t, a.x * (1 - t) + sign * b.x * t,
+        a.y * (1 - t) + sign * b.y * t, a.z * (1 - t) + sign * b.z * t});
+}
+
+void quaternion_to_matrix(struct Quaternion q, double m[3][3]) {
+    m[0][0] = 1 - 2 * (q.y * q.y + q.z * q.z);
+    m[0][1] = 2 * (q.x * q.y - q.w * q.z);
+    m[0][2] = 2 * (q.x * q.z + q.w * q.y);
+    m[1][0] = 2 * (q.x * q.y + q.w * q.z);
+    m[1][1] = 1 - 2 * (q.x * q.x + q.z * q.z);
+    m[1][2] = 2 * (q.y * q.z - q.w * q.x);
+    m[2][0] = 2 * (q.x * q.z - q.w * q.y);
+    m[2][1] = 2 * (q.y * q.z + q.w * q.x);
+    m[2][2] = 1 - 2 * (q.x * q.x + q.y * q.y);
+}
+
 void apply_rotation(struct Point* point, double alpha, double beta, double gamma) {
-    double rotation_matrix[3][3] = {{cos(alpha) * cos(beta), cos(alpha) * sin(beta) * sin(gamma) - sin(alpha) * cos(gamma), cos(alpha) * sin(beta) * cos(gamma) + sin(alpha) * sin(gamma)}, {sin(alpha) * cos(beta), sin(alpha) * sin(beta) * sin(gamma) + cos(alpha) * cos(gamma), sin(alpha) * sin(beta) * cos(gamma) - cos(alpha) * sin(gamma)}, {-sin(beta), cos(beta) * sin(gamma), cos(beta) * cos(gamma)}};
+    double rotation_matrix[3][3];
+    build_rotation_matrix(alpha, beta, gamma, rotation_matrix);
     double point_vector[3] = {point->x, point->y, point->z};
     double result_point[3];
     for (int i = 0; i < 3; i++) {
@@ -55,11 +211,774 @@ void apply_rotation(struct Point* point, double alpha, double beta, double gamma
     point->z = result_point[2];
 }
 
+int create_point_cloud(struct PointCloud* cloud, int count) {
+    int capacity = (count + CLOUD_LANES - 1) / CLOUD_LANES * CLOUD_LANES;
+    size_t size = (capacity ? capacity : CLOUD_LANES) * sizeof(float);
+    cloud->count = count;
+    cloud->capacity = capacity;
+    cloud->x = SDL_SIMDAlloc(size);
+    cloud->y = SDL_SIMDAlloc(size);
+    cloud->z = SDL_SIMDAlloc(size);
+    if (!cloud->x || !cloud->y || !cloud->z) return -1;
+    // the padding is transformed along with the points, keep it zero
+    SDL_memset(cloud->x, 0, size);
+    SDL_memset(cloud->y, 0, size);
+    SDL_memset(cloud->z, 0, size);
+    return 0;
+}
+
+void destroy_point_cloud(struct PointCloud* cloud) {
+    SDL_SIMDFree(cloud->x);
+    SDL_SIMDFree(cloud->y);
+    SDL_SIMDFree(cloud->z);
+}
+
+// Point cloud living in an arena: released with the arena, never with
+// destroy_point_cloud
+int arena_point_cloud(struct Arena* arena, struct PointCloud* cloud, int count) {
+    int capacity = (count + CLOUD_LANES - 1) / CLOUD_LANES * CLOUD_LANES;
+    size_t size = (capacity ? capacity : CLOUD_LANES) * sizeof(float);
+    cloud->count = count;
+    cloud->capacity = capacity;
+    // the padding is transformed along with the points, keep it zero
+    cloud->x = ArenaAllocZeroed(arena, size);
+    cloud->y = ArenaAllocZeroed(arena, size);
+    cloud->z = ArenaAllocZeroed(arena, size);
+    return cloud->x && cloud->y && cloud->z ? 0 : -1;
+}
+
+size_t arena_point_cloud_size(int count) {
+    int capacity = (count + CLOUD_LANES - 1) / CLOUD_LANES * CLOUD_LANES;
+    return 3 * ArenaSize((capacity ? capacity : CLOUD_LANES) * sizeof(float));
+}
+
+void point_cloud_from_points(struct PointCloud* cloud, struct Point points[], int number_of_points) {
+    for (int i = 0; i < number_of_points && i < cloud->count; i++) {
+        cloud->x[i] = (float) points[i].x;
+        cloud->y[i] = (float) points[i].y;
+        cloud->z[i] = (float) points[i].z;
+    }
+}
+
+void transform_points_scalar(const struct PointCloud* in, struct PointCloud* out, const float m[3][3]) {
+    for (int i = 0; i < in->count; i++) {
+        float x = in->x[i], y = in->y[i], z = in->z[i];
+        out->x[i] = m[0][0] * x + m[0][1] * y + m[0][2] * z;
+        out->y[i] = m[1][0] * x + m[1][1] * y + m[1][2] * z;
+        out->z[i] = m[2][0] * x + m[2][1] * y + m[2][2] * z;
+    }
+}
+
+#ifdef HAVE_X86_SIMD
+void transform_points_sse(const struct PointCloud* in, struct PointCloud* out, const float m[3][3]) {
+    __m128 m00 = _mm_set1_ps(m[0][0]), m01 = _mm_set1_ps(m[0][1]), m02 = _mm_set1_ps(m[0][2]);
+    __m128 m10 = _mm_set1_ps(m[1][0]), m11 = _mm_set1_ps(m[1][1]), m12 = _mm_set1_ps(m[1][2]);
+    __m128 m20 = _mm_set1_ps(m[2][0]), m21 = _mm_set1_ps(m[2][1]), m22 = _mm_set1_ps(m[2][2]);
+    for (int i = 0; i < in->count; i += 4) {
+        __m128 x = _mm_load_ps(&in->x[i]), y = _mm_load_ps(&in->y[i]), z = _mm_load_ps(&in->z[i]);
+        _mm_store_ps(&out->x[i], _mm_add_ps(_mm_add_ps(_mm_mul_ps(m00, x), _mm_mul_ps(m01, y)), _mm_mul_ps(m02, z)));
+        _mm_store_ps(&out->y[i], _mm_add_ps(_mm_add_ps(_mm_mul_ps(m10, x), _mm_mul_ps(m11, y)), _mm_mul_ps(m12, z)));
+        _mm_store_ps(&out->z[i], _mm_add_ps(_mm_add_ps(_mm_mul_ps(m20, x), _mm_mul_ps(m21, y)), _mm_mul_ps(m22, z)));
+    }
+}
+
+TARGET_AVX void transform_points_avx(const struct PointCloud* in, struct PointCloud* out, const float m[3][3]) {
+    __m256 m00 = _mm256_set1_ps(m[0][0]), m01 = _mm256_set1_ps(m[0][1]), m02 = _mm256_set1_ps(m[0][2]);
+    __m256 m10 = _mm256_set1_ps(m[1][0]), m11 = _mm256_set1_ps(m[1][1]), m12 = _mm256_set1_ps(m[1][2]);
+    __m256 m20 = _mm256_set1_ps(m[2][0]), m21 = _mm256_set1_ps(m[2][1]), m22 = _mm256_set1_ps(m[2][2]);
+    for (int i = 0; i < in->count; i += 8) {
+        __m256 x = _mm256_loadu_ps(&in->x[i]), y = _mm256_loadu_ps(&in->y[i]), z = _mm256_loadu_ps(&in->z[i]);
+        _mm256_storeu_ps(&out->x[i], _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m00, x), _mm256_mul_ps(m01, y)), _mm256_mul_ps(m02, z)));
+        _mm256_storeu_ps(&out->y[i], _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m10, x), _mm256_mul_ps(m11, y)), _mm256_mul_ps(m12, z)));
+        _mm256_storeu_ps(&out->z[i], _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m20, x), _mm256_mul_ps(m21, y)), _mm256_mul_ps(m22, z)));
+    }
+}
+#endif
+
+// Rotates every point of in into out (which may be in) with one matrix for
+// the whole batch; picks the widest kernel the CPU supports
+void transform_point_cloud(const struct PointCloud* in, struct PointCloud* out, const double rotation_matrix[3][3]) {
+    float m[3][3];
+    for (int i = 0; i < 3; i++)
+        for (int j = 0; j < 3; j++)
+            m[i][j] = (float) rotation_matrix[i][j];
+
+#ifdef HAVE_X86_SIMD
+    if (SDL_HasAVX()) {
+        transform_points_avx(in, out, m);
+        return;
+    }
+    if (SDL_HasSSE()) {
+        transform_points_sse(in, out, m);
+        return;
+    }
+#endif
+    transform_points_scalar(in, out, m);
+}
+
+void draw_point_cloud(SDL_Surface* surface, const struct PointCloud* cloud) {
+    for (int i = 0; i < cloud->count; i++)
+        draw_point(surface, cloud->x[i] + COORDINATE_SYSTEM_OFFSET_X, cloud->y[i] + COORDINATE_SYSTEM_OFFSET_Y);
+}
+
+int create_depth_buffer(struct DepthBuffer* buffer, int width, int height) {
+    buffer->width = width;
+    buffer->height = height;
+    buffer->depth = malloc((size_t) width * height * sizeof(float));
+    return buffer->depth ? 0 : -1;
+}
+
+void destroy_depth_buffer(struct DepthBuffer* buffer) {
+    free(buffer->depth);
+}
+
+void clear_depth_buffer(struct DepthBuffer* buffer, float far) {
+    for (int i = 0; i < buffer->width * buffer->height; i++)
+        buffer->depth[i] = far;
+}
+
+// Projects an already rotated point; returns 0 if it lies outside the near/far range
+int project_point(const struct Camera* camera, double x, double y, double z, double* screen_x, double* screen_y, double* depth) {
+    double view_z = z + camera->distance;
+    if (view_z < camera->near || view_z > camera->far) return 0;
+    *screen_x = COORDINATE_SYSTEM_OFFSET_X + camera->focal_length * x / view_z;
+    *screen_y = COORDINATE_SYSTEM_OFFSET_Y + camera->focal_length * y / view_z;
+    *depth = view_z;
+    return 1;
+}
+
+// Points further away than the camera distance fade out
+Uint32 depth_shade(SDL_PixelFormat* format, const struct Camera* camera, double depth) {
+    double intensity = camera->distance / depth;
+    intensity = SDL_clamp(intensity * intensity, 0.2, 1.0);
+    Uint8 level = (Uint8) (255 * intensity);
+    return SDL_MapRGB(format, level, level, level);
+}
+
+// POINT_SIZE square with its top left corner at (x, y), every pixel depth
+// tested on its own so points half behind a silhouette keep their visible part
+void draw_point_depth(SDL_Surface* surface, struct DepthBuffer* buffer, int x, int y, float depth, Uint32 color) {
+    int x_end = SDL_min(x + POINT_SIZE, buffer->width), y_end = SDL_min(y + POINT_SIZE, buffer->height);
+    for (int py = SDL_max(y, 0); py < y_end; py++) {
+        Uint32* row = (Uint32*) ((Uint8*) surface->pixels + py * surface->pitch);
+        float* depth_row = &buffer->depth[py * buffer->width];
+        for (int px = SDL_max(x, 0); px < x_end; px++) {
+            if (depth < depth_row[px]) {
+                depth_row[px] = depth;
+                row[px] = color;
+            }
+        }
+    }
+}
+
+// Clips the segment against the near and far planes, then walks it with
+// Bresenham interpolating 1 / z, which is linear in screen space
+void draw_line_depth(SDL_Surface* surface, struct DepthBuffer* buffer, const struct Camera* camera, struct Point a, struct Point b, Uint32 color) {
+    double za = a.z + camera->distance, zb = b.z + camera->distance;
+    double t0 = 0, t1 = 1;
+    if (za < camera->near && zb < camera->near) return;
+    if (za > camera->far && zb > camera->far) return;
+    if (za < camera->near) t0 = SDL_max(t0, (camera->near - za) / (zb - za));
+    if (zb < camera->near) t1 = SDL_min(t1, (camera->near - za) / (zb - za));
+    if (za > camera->far) t0 = SDL_max(t0, (camera->far - za) / (zb - za));
+    if (zb > camera->far) t1 = SDL_min(t1, (camera->far - za) / (zb - za));
+    if (t0 > t1) return;
+
+    struct Point start = {a.x + (b.x - a.x) * t0, a.y + (b.y - a.y) * t0, a.z + (b.z - a.z) * t0};
+    struct Point end = {a.x + (b.x - a.x) * t1, a.y + (b.y - a.y) * t1, a.z + (b.z - a.z) * t1};
+    double x0, y0, z0, x1, y1, z1;
+    if (!project_point(camera, start.x, start.y, start.z, &x0, &y0, &z0)) return;
+    if (!project_point(camera, end.x, end.y, end.z, &x1, &y1, &z1)) return;
+
+    int x = (int) floor(x0), y = (int) floor(y0);
+    int x_end = (int) floor(x1), y_end = (int) floor(y1);
+    int dx = abs(x_end - x), dy = -abs(y_end - y);
+    int sx = x < x_end ? 1 : -1, sy = y < y_end ? 1 : -1;
+    int error = dx + dy;
+    int steps = SDL_max(dx, -dy), step = 0;
+    double inverse_z0 = 1 / z0, inverse_z1 = 1 / z1;
+    while (1) {
+        if (x >= 0 && x < buffer->width && y >= 0 && y < buffer->height) {
+            double t = steps ? (double) step / steps : 0;
+            float depth = (float) (1 / (inverse_z0 + (inverse_z1 - inverse_z0) * t));
+            float* stored = &buffer->depth[y * buffer->width + x];
+            if (depth < *stored) {
+                *stored = depth;
+                ((Uint32*) ((Uint8*) surface->pixels + y * surface->pitch))[x] = color;
+            }
+        }
+        if (x == x_end && y == y_end) break;
+        int error2 = 2 * error;
+        if (error2 >= dy) {
+            error += dy;
+            x += sx;
+        }
+        if (error2 <= dx) {
+            error += dx;
+            y += sy;
+        }
+        ++step;
+    }
+}
+
+// Perspective, depth tested version of draw_point_cloud; expects a 32-bit surface
+void draw_point_cloud_depth(SDL_Surface* surface, struct DepthBuffer* buffer, const struct Camera* camera, const struct PointCloud* cloud) {
+    if (SDL_MUSTLOCK(surface)) SDL_LockSurface(surface);
+    for (int i = 0; i < cloud->count; i++) {
+        double x, y, depth;
+        if (!project_point(camera, cloud->x[i], cloud->y[i], cloud->z[i], &x, &y, &depth)) continue;
+        draw_point_depth(surface, buffer, (int) floor(x), (int) floor(y), (float) depth, depth_shade(surface->format, camera, depth));
+    }
+    if (SDL_MUSTLOCK(surface)) SDL_UnlockSurface(surface);
+}
+
+// Area weighted average of the face normals around each vertex
+int compute_vertex_normals(struct Mesh* mesh) {
+    if (create_point_cloud(&mesh->normals, mesh->vertices.count) != 0) return -1;
+    const struct PointCloud* v = &mesh->vertices;
+    struct PointCloud* n = &mesh->normals;
+    for (int t = 0; t < mesh->triangle_count; t++) {
+        int a = mesh->triangles[t * 3], b = mesh->triangles[t * 3 + 1], c = mesh->triangles[t * 3 + 2];
+        float ux = v->x[b] - v->x[a], uy = v->y[b] - v->y[a], uz = v->z[b] - v->z[a];
+        float wx = v->x[c] - v->x[a], wy = v->y[c] - v->y[a], wz = v->z[c] - v->z[a];
+        float nx = uy * wz - uz * wy, ny = uz * wx - ux * wz, nz = ux * wy - uy * wx;
+        for (int k = 0; k < 3; k++) {
+            int i = mesh->triangles[t * 3 + k];
+            n->x[i] += nx;
+            n->y[i] += ny;
+            n->z[i] += nz;
+        }
+    }
+    for (int i = 0; i < n->count; i++) {
+        float length = sqrtf(n->x[i] * n->x[i] + n->y[i] * n->y[i] + n->z[i] * n->z[i]);
+        if (length > 0) {
+            n->x[i] /= length;
+            n->y[i] /= length;
+            n->z[i] /= length;
+        }
+    }
+    return 0;
+}
+
+void destroy_mesh(struct Mesh* mesh) {
+    destroy_point_cloud(&mesh->vertices);
+    destroy_point_cloud(&mesh->normals);
+    free(mesh->edges);
+    free(mesh->triangles);
+    SDL_zerop(mesh);
+}
+
+static int compare_edges(const void* a, const void* b) {
+    const int* x = a;
+    const int* y = b;
+    if (x[0] != y[0]) return x[0] - y[0];
+    return x[1] - y[1];
+}
+
+// Appends a polygon: its border goes to the edge list, its triangle fan to the
+// triangles. The capacities grow by doubling.
+int mesh_add_polygon(struct Mesh* mesh, const int* corners, int count, int* edge_capacity, int* triangle_capacity) {
+    if (mesh->edge_count + count > *edge_capacity) {
+        int capacity = SDL_max(*edge_capacity * 2, mesh->edge_count + count + 1024);
+        int* grown = realloc(mesh->edges, (size_t) capacity * 2 * sizeof(int));
+        if (!grown) return -1;
+        mesh->edges = grown;
+        *edge_capacity = capacity;
+    }
+    if (mesh->triangle_count + count > *triangle_capacity) {
+        int capacity = SDL_max(*triangle_capacity * 2, mesh->triangle_count + count + 1024);
+        int* grown = realloc(mesh->triangles, (size_t) capacity * 3 * sizeof(int));
+        if (!grown) return -1;
+        mesh->triangles = grown;
+        *triangle_capacity = capacity;
+    }
+    for (int k = 0; k < count; k++) {
+        int a = corners[k], b = corners[(k + 1) % count];
+        int* edge = &mesh->edges[mesh->edge_count++ * 2];
+        edge[0] = SDL_min(a, b);
+        edge[1] = SDL_max(a, b);
+    }
+    for (int k = 1; k + 1 < count; k++) {
+        int* triangle = &mesh->triangles[mesh->triangle_count++ * 3];
+        triangle[0] = corners[0];
+        triangle[1] = corners[k];
+        triangle[2] = corners[k + 1];
+    }
+    return 0;
+}
+
+// Sorts the edge list and drops the copies of edges shared by two polygons
+void remove_duplicate_edges(struct Mesh* mesh) {
+    SDL_qsort(mesh->edges, mesh->edge_count, 2 * sizeof(int), compare_edges);
+    int unique = 0;
+    for (int i = 0; i < mesh->edge_count; i++) {
+        if (unique > 0 && compare_edges(&mesh->edges[i * 2], &mesh->edges[(unique - 1) * 2]) == 0) continue;
+        mesh->edges[unique * 2] = mesh->edges[i * 2];
+        mesh->edges[unique * 2 + 1] = mesh->edges[i * 2 + 1];
+        ++unique;
+    }
+    mesh->edge_count = unique;
+}
+
+int create_cube_mesh(struct Mesh* mesh, double side_length) {
+    static const float cube_vertices[8][3] = {
+        {-1, -1, -1}, {1, -1, -1}, {1, 1, -1}, {-1, 1, -1},
+        {-1, -1, 1}, {1, -1, 1}, {1, 1, 1}, {-1, 1, 1}
+    };
+    // faces wound so that (b - a) x (c - a) points out of the cube
+    static const int cube_faces[6][4] = {
+        {0, 3, 2, 1}, {4, 5, 6, 7}, {0, 1, 5, 4},
+        {3, 7, 6, 2}, {0, 4, 7, 3}, {1, 2, 6, 5}
+    };
+    int edge_capacity = 0, triangle_capacity = 0;
+    SDL_zerop(mesh);
+    if (create_point_cloud(&mesh->vertices, 8) != 0) return -1;
+    for (int i = 0; i < 8; i++) {
+        mesh->vertices.x[i] = (float) (cube_vertices[i][0] * side_length / 2);
+        mesh->vertices.y[i] = (float) (cube_vertices[i][1] * side_length / 2);
+        mesh->vertices.z[i] = (float) (cube_vertices[i][2] * side_length / 2);
+    }
+    for (int f = 0; f < 6; f++) {
+        if (mesh_add_polygon(mesh, cube_faces[f], 4, &edge_capacity, &triangle_capacity) != 0) return -1;
+    }
+    remove_duplicate_edges(mesh);
+    return compute_vertex_normals(mesh);
+}
+
+// Minimal Wavefront OBJ reader: "v x y z" and polygon "f" lines (v, v/vt,
+// v//vn and v/vt/vn, negative indices allowed), polygons are fanned into
+// triangles. The model is centered and scaled to fit a sphere of radius size.
+int load_obj_mesh(struct Mesh* mesh, const char* filename, double size) {
+    SDL_zerop(mesh);
+    FILE* file = fopen(filename, "r");
+    if (!file) return -1;
+
+    double* positions = NULL;
+    int position_count = 0, position_capacity = 0;
+    int edge_capacity = 0, triangle_capacity = 0;
+    int ok = 1;
+    char line[1024];
+    while (ok && fgets(line, sizeof(line), file)) {
+        if (line[0] == 'v' && line[1] == ' ') {
+            if (position_count == position_capacity) {
+                position_capacity = position_capacity ? position_capacity * 2 : 1024;
+                double* grown = realloc(positions, (size_t) position_capacity * 3 * sizeof(double));
+                if (!grown) {
+                    ok = 0;
+                    break;
+                }
+                positions = grown;
+            }
+            double* p = &positions[position_count * 3];
+            if (sscanf(line + 2, "%lf %lf %lf", &p[0], &p[1], &p[2]) == 3) ++position_count;
+        } else if (line[0] == 'f' && line[1] == ' ') {
+            int face[64], corners = 0;
+            char* save = NULL;
+            for (char* token = SDL_strtokr(line + 2, " \t\r\n", &save); token && corners < 64; token = SDL_strtokr(NULL, " \t\r\n", &save)) {
+                int index = SDL_atoi(token);
+                index = index < 0 ? position_count + index : index - 1;
+                if (index < 0 || index >= position_count) {
+                    ok = 0;
+                    break;
+                }
+                face[corners++] = index;
+            }
+            if (ok && corners >= 3)
+                ok = mesh_add_polygon(mesh, face, corners, &edge_capacity, &triangle_capacity) == 0;
+        }
+    }
+    fclose(file);
+
+    if (ok && position_count > 0 && create_point_cloud(&mesh->vertices, position_count) == 0) {
+        double min[3] = {INFINITY, INFINITY, INFINITY}, max[3] = {-INFINITY, -INFINITY, -INFINITY};
+        for (int i = 0; i < position_count * 3; i++) {
+            min[i % 3] = SDL_min(min[i % 3], positions[i]);
+            max[i % 3] = SDL_max(max[i % 3], positions[i]);
+        }
+        double center[3], radius = 0;
+        for (int k = 0; k < 3; k++) center[k] = (min[k] + max[k]) / 2;
+        for (int i = 0; i < position_count; i++) {
+            double* p = &positions[i * 3];
+            radius = SDL_max(radius, sqrt((p[0] - center[0]) * (p[0] - center[0]) + (p[1] - center[1]) * (p[1] - center[1]) + (p[2] - center[2]) * (p[2] - center[2])));
+        }
+        double scale = radius > 0 ? size / radius : 1;
+        for (int i = 0; i < position_count; i++) {
+            // OBJ is y up and the screen y down: turn the model half way around
+            // x, which unlike a mirror keeps the winding of the faces
+            mesh->vertices.x[i] = (float) ((positions[i * 3] - center[0]) * scale);
+            mesh->vertices.y[i] = (float) (-(positions[i * 3 + 1] - center[1]) * scale);
+            mesh->vertices.z[i] = (float) (-(positions[i * 3 + 2] - center[2]) * scale);
+        }
+    } else {
+        ok = 0;
+    }
+    free(positions);
+
+    if (!ok) {
+        destroy_mesh(mesh);
+        return -1;
+    }
+    remove_duplicate_edges(mesh);
+    if (compute_vertex_normals(mesh) != 0) {
+        destroy_mesh(mesh);
+        return -1;
+    }
+    return 0;
+}
+
+// Draws every edge of a mesh whose vertices have already been transformed
+void draw_mesh_edges(SDL_Surface* surface, struct DepthBuffer* buffer, const struct Camera* camera, const struct Mesh* mesh, const struct PointCloud* vertices, Uint32 color) {
+    if (SDL_MUSTLOCK(surface)) SDL_LockSurface(surface);
+    for (int i = 0; i < mesh->edge_count; i++) {
+        int a = mesh->edges[i * 2], b = mesh->edges[i * 2 + 1];
+        struct Point start = {vertices->x[a], vertices->y[a], vertices->z[a]};
+        struct Point end = {vertices->x[b], vertices->y[b], vertices->z[b]};
+        draw_line_depth(surface, buffer, camera, start, end, color);
+    }
+    if (SDL_MUSTLOCK(surface)) SDL_UnlockSurface(surface);
+}
+
+enum RenderMode {
+    RENDER_FLAT,
+    RENDER_GOURAUD,
+    RENDER_EDGES,
+    RENDER_POINTS,
+    RENDER_MODE_COUNT
+};
+
+// Screen position, view z and light intensity of a triangle corner
+struct RasterVertex {
+    float x, y, z;
+    float intensity;
+};
+
+// Triangles are set up, culled and clipped once, binned into screen tiles,
+// and the tiles are rasterized in parallel. The triangle buffer holds the
+// most the mesh can give; the bins, whose count depends on the view, come
+// from the frame arena and live until its reset at the end of the frame.
+struct Rasterizer {
+    struct Arena* frame;
+    struct RasterVertex* triangles;
+    int triangle_count;
+    int* bin_entries;
+    int bin_start[RASTER_TILES_X * RASTER_TILES_Y + 1];
+    SDL_Surface* surface;
+    struct DepthBuffer* depth;
+    Uint32 color;
+    // shade with the scalar reference even where SSE is available
+    int scalar_shading;
+};
+
+float light_intensity(float nx, float ny, float nz) {
+    float diffuse = -(nx * LIGHT_DIRECTION_X + ny * LIGHT_DIRECTION_Y + nz * LIGHT_DIRECTION_Z);
+    return AMBIENT_LIGHT + (1 - AMBIENT_LIGHT) * SDL_max(diffuse, 0.0f);
+}
+
+// Point of a view space triangle corner: position and intensity
+struct ClipVertex {
+    float x, y, z;
+    float intensity;
+};
+
+struct ClipVertex lerp_clip_vertex(struct ClipVertex a, struct ClipVertex b, float t) {
+    return (struct ClipVertex) {a.x + (b.x - a.x) * t, a.y + (b.y - a.y) * t, a.z + (b.z - a.z) * t, a.intensity + (b.intensity - a.intensity) * t};
+}
+
+void add_raster_triangle(struct Rasterizer* rasterizer, const struct Camera* camera, struct ClipVertex a, struct ClipVertex b, struct ClipVertex c) {
+    struct ClipVertex corners[3] = {a, b, c};
+    struct RasterVertex projected[3];
+    for (int k = 0; k < 3; k++) {
+        projected[k].x = (float) (COORDINATE_SYSTEM_OFFSET_X + camera->focal_length * corners[k].x / corners[k].z);
+        projected[k].y = (float) (COORDINATE_SYSTEM_OFFSET_Y + camera->focal_length * corners[k].y / corners[k].z);
+        projected[k].z = corners[k].z;
+        projected[k].intensity = corners[k].intensity;
+    }
+    // with y pointing down, faces turned towards the camera have negative area
+    float area = (projected[1].x - projected[0].x) * (projected[2].y - projected[0].y) - (projected[1].y - projected[0].y) * (projected[2].x - projected[0].x);
+    if (area >= 0) return;
+
+    // stored with positive area so inside means all edge functions >= 0
+    struct RasterVertex* triangle = &rasterizer->triangles[rasterizer->triangle_count++ * 3];
+    triangle[0] = projected[0];
+    triangle[1] = projected[2];
+    triangle[2] = projected[1];
+}
+
+// Vertex stage: lights, near/far clips, projects and back-face culls every
+// triangle of the mesh. Flat shading lights the face normal, Gouraud the
+// vertex normals.
+void setup_mesh_triangles(struct Rasterizer* rasterizer, const struct Camera* camera, const struct Mesh* mesh, const struct PointCloud* vertices, const struct PointCloud* normals, int gouraud) {
+    rasterizer->triangle_count = 0;
+    for (int t = 0; t < mesh->triangle_count; t++) {
+        struct ClipVertex corners[3];
+        for (int k = 0; k < 3; k++) {
+            int i = mesh->triangles[t * 3 + k];
+            corners[k] = (struct ClipVertex) {vertices->x[i], vertices->y[i], (float) (vertices->z[i] + camera->distance), 1};
+            if (gouraud) corners[k].intensity = light_intensity(normals->x[i], normals->y[i], normals->z[i]);
+        }
+        if (corners[0].z > camera->far && corners[1].z > camera->far && corners[2].z > camera->far) continue;
+        if (!gouraud) {
+            float ux = corners[1].x - corners[0].x, uy = corners[1].y - corners[0].y, uz = corners[1].z - corners[0].z;
+            float wx = corners[2].x - corners[0].x, wy = corners[2].y - corners[0].y, wz = corners[2].z - corners[0].z;
+            float nx = uy * wz - uz * wy, ny = uz * wx - ux * wz, nz = ux * wy - uy * wx;
+            float length = sqrtf(nx * nx + ny * ny + nz * nz);
+            float intensity = length > 0 ? light_intensity(nx / length, ny / length, nz / length) : AMBIENT_LIGHT;
+            for (int k = 0; k < 3; k++) corners[k].intensity = intensity;
+        }
+
+        // clipping against the near plane leaves at most four corners
+        struct ClipVertex polygon[4];
+        int count = 0;
+        for (int k = 0; k < 3; k++) {
+            struct ClipVertex current = corners[k], next = corners[(k + 1) % 3];
+            int current_inside = current.z >= camera->near, next_inside = next.z >= camera->near;
+            if (current_inside) polygon[count++] = current;
+            if (current_inside != next_inside)
+                polygon[count++] = lerp_clip_vertex(current, next, (float) ((camera->near - current.z) / (next.z - current.z)));
+        }
+        for (int k = 1; k + 1 < count; k++)
+            add_raster_triangle(rasterizer, camera, polygon[0], polygon[k], polygon[k + 1]);
+    }
+}
+
+void triangle_bounds(const struct RasterVertex* triangle, int* min_x, int* min_y, int* max_x, int* max_y) {
+    float low_x = SDL_min(triangle[0].x, SDL_min(triangle[1].x, triangle[2].x));
+    float low_y = SDL_min(triangle[0].y, SDL_min(triangle[1].y, triangle[2].y));
+    float high_x = SDL_max(triangle[0].x, SDL_max(triangle[1].x, triangle[2].x));
+    float high_y = SDL_max(triangle[0].y, SDL_max(triangle[1].y, triangle[2].y));
+    *min_x = (int) SDL_max(floorf(low_x), 0);
+    *min_y = (int) SDL_max(floorf(low_y), 0);
+    *max_x = (int) SDL_min(ceilf(high_x), WIDTH - 1);
+    *max_y = (int) SDL_min(ceilf(high_y), HEIGHT - 1);
+}
+
+// Counting sort of the triangles into the tiles their bounding box touches;
+// triangles keep submission order inside each tile. The bins are the first
+// allocation of the frame, so a frame needing more than the arena holds
+// grows it here. Returns -1 when that failed.
+int bin_triangles(struct Rasterizer* rasterizer) {
+    int tile_count = RASTER_TILES_X * RASTER_TILES_Y;
+    int* start = rasterizer->bin_start;
+    SDL_memset(start, 0, sizeof(rasterizer->bin_start));
+    for (int pass = 0; pass < 2; pass++) {
+        for (int t = 0; t < rasterizer->triangle_count; t++) {
+            int min_x, min_y, max_x, max_y;
+            triangle_bounds(&rasterizer->triangles[t * 3], &min_x, &min_y, &max_x, &max_y);
+            if (min_x > max_x || min_y > max_y) continue;
+            for (int ty = min_y / RASTER_TILE_SIZE; ty <= max_y / RASTER_TILE_SIZE; ty++) {
+                for (int tx = min_x / RASTER_TILE_SIZE; tx <= max_x / RASTER_TILE_SIZE; tx++) {
+                    int tile = ty * RASTER_TILES_X + tx;
+                    if (pass == 0) start[tile + 1]++;
+                    else rasterizer->bin_entries[start[tile]++] = t;
+                }
+            }
+        }
+        if (pass == 0) {
+            for (int tile = 0; tile < tile_count; tile++) start[tile + 1] += start[tile];
+            size_t bin_size = (size_t) start[tile_count] * sizeof(int);
+            if (GrowArena(rasterizer->frame, bin_size) != 0) return -1;
+            rasterizer->bin_entries = ArenaAlloc(rasterizer->frame, bin_size);
+        } else {
+            // filling advanced every start to the next tile's, shift back
+            for (int tile = tile_count; tile > 0; tile--) start[tile] = start[tile - 1];
+            start[0] = 0;
+        }
+    }
+    return 0;
+}
+
+// Edge functions of one triangle: w = w0 + dx * x + dy * y, all three >= 0 inside
+struct TriangleSetup {
+    float w0[3], dx[3], dy[3];
+    float inverse_area;
+    float inverse_z[3];
+    float intensity[3];
+};
+
+struct TriangleSetup setup_triangle(const struct RasterVertex* v) {
+    struct TriangleSetup setup;
+    for (int k = 0; k < 3; k++) {
+        const struct RasterVertex* a = &v[(k + 1) % 3];
+        const struct RasterVertex* b = &v[(k + 2) % 3];
+        setup.dx[k] = a->y - b->y;
+        setup.dy[k] = b->x - a->x;
+        setup.w0[k] = -(setup.dx[k] * a->x + setup.dy[k] * a->y);
+        setup.inverse_z[k] = 1 / v[k].z;
+        setup.intensity[k] = v[k].intensity;
+    }
+    float area = setup.w0[0] + setup.dx[0] * v[0].x + setup.dy[0] * v[0].y;
+    setup.inverse_area = 1 / area;
+    return setup;
+}
+
+// Channel layout of a 32-bit surface, resolved once per frame
+struct PixelLayout {
+    int r_shift, g_shift, b_shift;
+    float r, g, b;
+};
+
+void shade_block_scalar(const struct Rasterizer* rasterizer, const struct TriangleSetup* setup, const struct PixelLayout* layout, int block_x, int block_y, int x_end, int y_end) {
+    SDL_Surface* surface = rasterizer->surface;
+    for (int y = block_y; y < y_end; y++) {
+        Uint32* row = (Uint32*) ((Uint8*) surface->pixels + y * surface->pitch);
+        float* depth_row = &rasterizer->depth->depth[y * WIDTH];
+        for (int x = block_x; x < x_end; x++) {
+            float px = x + 0.5f, py = y + 0.5f;
+            float w[3];
+            for (int k = 0; k < 3; k++) w[k] = setup->w0[k] + (setup->dx[k] * px + setup->dy[k] * py);
+            if (w[0] < 0 || w[1] < 0 || w[2] < 0) continue;
+            float l0 = w[0] * setup->inverse_area, l1 = w[1] * setup->inverse_area, l2 = w[2] * setup->inverse_area;
+            float depth = 1 / (l0 * setup->inverse_z[0] + l1 * setup->inverse_z[1] + l2 * setup->inverse_z[2]);
+            if (depth >= depth_row[x]) continue;
+            float intensity = l0 * setup->intensity[0] + l1 * setup->intensity[1] + l2 * setup->intensity[2];
+            depth_row[x] = depth;
+            row[x] = ((Uint32) (layout->r * intensity) << layout->r_shift) | ((Uint32) (layout->g * intensity) << layout->g_shift) | ((Uint32) (layout->b * intensity) << layout->b_shift);
+        }
+    }
+}
+
+#ifdef HAVE_X86_SIMD
+// Same as shade_block_scalar, four pixels of a row per SSE register
+void shade_block_sse(const struct Rasterizer* rasterizer, const struct TriangleSetup* setup, const struct PixelLayout* layout, int block_x, int block_y, int x_end, int y_end) {
+    SDL_Surface* surface = rasterizer->surface;
+    __m128 lane = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+    __m128 zero = _mm_setzero_ps();
+    __m128 one = _mm_set1_ps(1);
+    __m128 inverse_area = _mm_set1_ps(setup->inverse_area);
+    __m128i x_limit = _mm_set1_epi32(x_end);
+    for (int y = block_y; y < y_end; y++) {
+        Uint32* row = (Uint32*) ((Uint8*) surface->pixels + y * surface->pitch);
+        float* depth_row = &rasterizer->depth->depth[y * WIDTH];
+        __m128 py = _mm_set1_ps(y + 0.5f);
+        for (int x = block_x; x < x_end; x += 4) {
+            __m128 px = _mm_add_ps(_mm_set1_ps((float) x), lane);
+            __m128 w[3], inside = _mm_castsi128_ps(_mm_cmplt_epi32(_mm_add_epi32(_mm_set1_epi32(x), _mm_set_epi32(3, 2, 1, 0)), x_limit));
+            for (int k = 0; k < 3; k++) {
+                w[k] = _mm_add_ps(_mm_set1_ps(setup->w0[k]), _mm_add_ps(_mm_mul_ps(_mm_set1_ps(setup->dx[k]), px), _mm_mul_ps(_mm_set1_ps(setup->dy[k]), py)));
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(w[k], zero));
+            }
+            if (!_mm_movemask_ps(inside)) continue;
+
+            __m128 l0 = _mm_mul_ps(w[0], inverse_area), l1 = _mm_mul_ps(w[1], inverse_area), l2 = _mm_mul_ps(w[2], inverse_area);
+            __m128 inverse_z = _mm_add_ps(_mm_add_ps(_mm_mul_ps(l0, _mm_set1_ps(setup->inverse_z[0])), _mm_mul_ps(l1, _mm_set1_ps(setup->inverse_z[1]))), _mm_mul_ps(l2, _mm_set1_ps(setup->inverse_z[2])));
+            __m128 depth = _mm_div_ps(one, inverse_z);
+            __m128 stored = _mm_loadu_ps(&depth_row[x]);
+            __m128 pass = _mm_and_ps(inside, _mm_cmplt_ps(depth, stored));
+            if (!_mm_movemask_ps(pass)) continue;
+
+            __m128 intensity = _mm_add_ps(_mm_add_ps(_mm_mul_ps(l0, _mm_set1_ps(setup->intensity[0])), _mm_mul_ps(l1, _mm_set1_ps(setup->intensity[1]))), _mm_mul_ps(l2, _mm_set1_ps(setup->intensity[2])));
+            __m128i r = _mm_cvttps_epi32(_mm_mul_ps(intensity, _mm_set1_ps(layout->r)));
+            __m128i g = _mm_cvttps_epi32(_mm_mul_ps(intensity, _mm_set1_ps(layout->g)));
+            __m128i b = _mm_cvttps_epi32(_mm_mul_ps(intensity, _mm_set1_ps(layout->b)));
+            __m128i color = _mm_or_si128(_mm_or_si128(_mm_sll_epi32(r, _mm_cvtsi32_si128(layout->r_shift)), _mm_sll_epi32(g, _mm_cvtsi32_si128(layout->g_shift))), _mm_sll_epi32(b, _mm_cvtsi32_si128(layout->b_shift)));
+
+            __m128i pass_bits = _mm_castps_si128(pass);
+            __m128i pixels = _mm_loadu_si128((__m128i*) &row[x]);
+            _mm_storeu_ps(&depth_row[x], _mm_or_ps(_mm_and_ps(pass, depth), _mm_andnot_ps(pass, stored)));
+            _mm_storeu_si128((__m128i*) &row[x], _mm_or_si128(_mm_and_si128(pass_bits, color), _mm_andnot_si128(pass_bits, pixels)));
+        }
+    }
+}
+#endif
+
+struct PixelLayout pixel_layout(SDL_PixelFormat* format, Uint32 color) {
+    struct PixelLayout layout;
+    layout.r_shift = format->Rshift;
+    layout.g_shift = format->Gshift;
+    layout.b_shift = format->Bshift;
+    layout.r = (float) ((color >> 16) & 0xff);
+    layout.g = (float) ((color >> 8) & 0xff);
+    layout.b = (float) (color & 0xff);
+    return layout;
+}
+
+// Rasterizes every triangle binned into one tile, RASTER_BLOCK_SIZE square
+// blocks at a time; blocks entirely outside one edge are skipped
+void rasterize_tile_job(void* context, int tile) {
+    struct Rasterizer* rasterizer = context;
+    struct PixelLayout layout = pixel_layout(rasterizer->surface->format, rasterizer->color);
+    int tile_x = (tile % RASTER_TILES_X) * RASTER_TILE_SIZE;
+    int tile_y = (tile / RASTER_TILES_X) * RASTER_TILE_SIZE;
+    int tile_x_end = SDL_min(tile_x + RASTER_TILE_SIZE, WIDTH);
+    int tile_y_end = SDL_min(tile_y + RASTER_TILE_SIZE, HEIGHT);
+
+    for (int entry = rasterizer->bin_start[tile]; entry < rasterizer->bin_start[tile + 1]; entry++) {
+        const struct RasterVertex* triangle = &rasterizer->triangles[rasterizer->bin_entries[entry] * 3];
+        struct TriangleSetup setup = setup_triangle(triangle);
+        int min_x, min_y, max_x, max_y;
+        triangle_bounds(triangle, &min_x, &min_y, &max_x, &max_y);
+        min_x = SDL_max(min_x, tile_x) / RASTER_BLOCK_SIZE * RASTER_BLOCK_SIZE;
+        min_y = SDL_max(min_y, tile_y) / RASTER_BLOCK_SIZE * RASTER_BLOCK_SIZE;
+        max_x = SDL_min(max_x + 1, tile_x_end);
+        max_y = SDL_min(max_y + 1, tile_y_end);
+
+        for (int block_y = min_y; block_y < max_y; block_y += RASTER_BLOCK_SIZE) {
+            for (int block_x = min_x; block_x < max_x; block_x += RASTER_BLOCK_SIZE) {
+                int outside = 0;
+                for (int k = 0; k < 3 && !outside; k++) {
+                    // the block corner where this edge function is largest
+                    float corner_x = block_x + (setup.dx[k] > 0 ? RASTER_BLOCK_SIZE : 0);
+                    float corner_y = block_y + (setup.dy[k] > 0 ? RASTER_BLOCK_SIZE : 0);
+                    outside = setup.w0[k] + setup.dx[k] * corner_x + setup.dy[k] * corner_y < 0;
+                }
+                if (outside) continue;
+                int x_end = SDL_min(block_x + RASTER_BLOCK_SIZE, max_x);
+                int y_end = SDL_min(block_y + RASTER_BLOCK_SIZE, max_y);
+#ifdef HAVE_X86_SIMD
+                if (!rasterizer->scalar_shading) {
+                    shade_block_sse(rasterizer, &setup, &layout, block_x, block_y, x_end, y_end);
+                    continue;
+                }
+#endif
+                shade_block_scalar(rasterizer, &setup, &layout, block_x, block_y, x_end, y_end);
+            }
+        }
+    }
+}
+
+// Draws the mesh filled: vertices and normals must already be rotated into
+// view orientation. Expects a 32-bit surface and the rasterizer created for
+// mesh. Returns -1 and draws nothing when the frame arena could not grow to
+// the bins of the frame.
+int draw_mesh_filled(struct WorkerPool* pool, struct Rasterizer* rasterizer, SDL_Surface* surface, struct DepthBuffer* buffer, const struct Camera* camera, const struct Mesh* mesh, const struct PointCloud* vertices, const struct PointCloud* normals, Uint32 color, int gouraud) {
+    setup_mesh_triangles(rasterizer, camera, mesh, vertices, normals, gouraud);
+    if (bin_triangles(rasterizer) != 0) return -1;
+    rasterizer->surface = surface;
+    rasterizer->depth = buffer;
+    rasterizer->color = color;
+    if (SDL_MUSTLOCK(surface)) SDL_LockSurface(surface);
+    DispatchJobs(pool, rasterize_tile_job, rasterizer, RASTER_TILES_X * RASTER_TILES_Y);
+    if (SDL_MUSTLOCK(surface)) SDL_UnlockSurface(surface);
+    return 0;
+}
+
+// Starting size of the frame arena for draw_mesh_filled: every triangle
+// clipped in two and binned into four tiles, with room for a few screen
+// filling ones. Frames needing more grow the arena as they are drawn.
+size_t frame_arena_size(const struct Mesh* mesh) {
+    size_t bin_entries = (size_t) mesh->triangle_count * 2 * 4 + RASTER_TILES_X * RASTER_TILES_Y * FRAME_SCREEN_BINS;
+    return ArenaSize(bin_entries * sizeof(int));
+}
+
+// Rasterizer for mesh binning into frame, with room for every triangle of
+// the mesh split in two by the near clip
+int create_rasterizer(struct Rasterizer* rasterizer, const struct Mesh* mesh, struct Arena* frame) {
+    SDL_zerop(rasterizer);
+    rasterizer->frame = frame;
+    rasterizer->triangles = SDL_malloc(SDL_max((size_t) mesh->triangle_count * 2 * 3, 1) * sizeof(struct RasterVertex));
+    return rasterizer->triangles ? 0 : -1;
+}
+
+void destroy_rasterizer(struct Rasterizer* rasterizer) {
+    SDL_free(rasterizer->triangles);
+    rasterizer->triangles = NULL;
+}
+
 void initialize_cube(struct Point points[], int number_of_points) {
     // A cube has 12 sides
     int poinst_per_side = number_of_points / 12;
     int SIDE_LENGTH = 200;
-    int step_size = SIDE_LENGTH / poinst_per_side;
+    double step_size = (double) SIDE_LENGTH / poinst_per_side;
     // Side 1
     for (int i = 0; i < poinst_per_side; i++) {
         points[i] = (struct Point) {-SIDE_LENGTH / 2 + i * step_size, -SIDE_LENGTH / 2, SIDE_LENGTH / 2};
@@ -108,57 +1027,600 @@ void initialize_cube(struct Point points[], int number_of_points) {
     for (int i = 0; i < poinst_per_side; i++) {
         points[i + 11 * poinst_per_side] = (struct Point) {-SIDE_LENGTH / 2, SIDE_LENGTH / 2, -SIDE_LENGTH / 2 + i * step_size};
     }
+    // The number_of_points % 12 left over go one each onto the first sides,
+    // halfway between the side's first two points
+    int sampled = 12 * poinst_per_side;
+    for (int side = 0; side < number_of_points - sampled; side++) {
+        struct Point first = points[side * poinst_per_side], second = points[side * poinst_per_side + 1];
+        points[sampled + side] = (struct Point) {(first.x + second.x) / 2, (first.y + second.y) / 2, (first.z + second.z) / 2};
+    }
 }
 
-int APIENTRY WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine, int nShowCmd) {
-    if (SDL_Init(SDL_INIT_VIDEO) != 0) {
-        MessageBox(NULL, "SDL initialization failed", "Error", MB_OK | MB_ICONERROR);
-        return 1;
+// Inputs of the kernels timed by --microbench
+struct KernelInputs {
+    struct WorkerPool* pool;
+    SDL_Surface* surface;
+    struct DepthBuffer depth_buffer;
+    struct Camera camera;
+    struct Point* points;
+    int point_count;
+    struct PointCloud model;
+    struct PointCloud view;
+    double rotation_matrix[3][3];
+    float float_matrix[3][3];
+    struct Mesh mesh;
+    struct PointCloud mesh_view;
+    struct PointCloud normals_view;
+    struct Rasterizer rasterizer;
+    struct Arena frame;
+    int gouraud;
+    int mesh_loaded;
+};
+
+void apply_rotation_kernel(void* context) {
+    struct KernelInputs* inputs = context;
+    for (int i = 0; i < inputs->point_count; i++)
+        apply_rotation(&inputs->points[i], 0.01, 0.02, 0.03);
+}
+
+void transform_points_scalar_kernel(void* context) {
+    struct KernelInputs* inputs = context;
+    transform_points_scalar(&inputs->model, &inputs->view, inputs->float_matrix);
+}
+
+#ifdef HAVE_X86_SIMD
+void transform_points_sse_kernel(void* context) {
+    struct KernelInputs* inputs = context;
+    transform_points_sse(&inputs->model, &inputs->view, inputs->float_matrix);
+}
+
+void transform_points_avx_kernel(void* context) {
+    struct KernelInputs* inputs = context;
+    transform_points_avx(&inputs->model, &inputs->view, inputs->float_matrix);
+}
+#endif
+
+void draw_point_cloud_depth_kernel(void* context) {
+    struct KernelInputs* inputs = context;
+    clear_depth_buffer(&inputs->depth_buffer, FAR_PLANE);
+    draw_point_cloud_depth(inputs->surface, &inputs->depth_buffer, &inputs->camera, &inputs->view);
+}
+
+void draw_mesh_edges_kernel(void* context) {
+    struct KernelInputs* inputs = context;
+    clear_depth_buffer(&inputs->depth_buffer, FAR_PLANE);
+    draw_mesh_edges(inputs->surface, &inputs->depth_buffer, &inputs->camera, &inputs->mesh, &inputs->mesh_view, COLOR_EDGE);
+}
+
+void draw_mesh_filled_kernel(void* context) {
+    struct KernelInputs* inputs = context;
+    ResetArena(&inputs->frame);
+    clear_depth_buffer(&inputs->depth_buffer, FAR_PLANE);
+    draw_mesh_filled(inputs->pool, &inputs->rasterizer, inputs->surface, &inputs->depth_buffer, &inputs->camera,
+                     &inputs->mesh, &inputs->mesh_view, &inputs->normals_view, COLOR_MESH, inputs->gouraud);
+}
+
+// Sampled cube, mesh and their views at orientation, shared by the
+// micro-benchmarks and the tests
+int create_kernel_inputs(struct KernelInputs* inputs, struct WorkerPool* pool, int point_count, const char* model_path) {
+    SDL_zerop(inputs);
+    inputs->pool = pool;
+    inputs->camera = (struct Camera) {CAMERA_DISTANCE, FOCAL_LENGTH, NEAR_PLANE, FAR_PLANE};
+    inputs->point_count = point_count;
+    inputs->points = malloc(point_count * sizeof(struct Point));
+    inputs->surface = SDL_CreateRGBSurfaceWithFormat(0, WIDTH, HEIGHT, 32, SDL_PIXELFORMAT_XRGB8888);
+    inputs->mesh_loaded = (model_path[0] ? load_obj_mesh(&inputs->mesh, model_path, OBJ_RADIUS) : create_cube_mesh(&inputs->mesh, CUBE_SIDE_LENGTH)) == 0;
+    int ok = inputs->points && inputs->surface && inputs->mesh_loaded
+          && create_depth_buffer(&inputs->depth_buffer, WIDTH, HEIGHT) == 0
+          && create_point_cloud(&inputs->model, point_count) == 0
+          && create_point_cloud(&inputs->view, point_count) == 0
+          && create_point_cloud(&inputs->mesh_view, inputs->mesh.vertices.count) == 0
+          && create_point_cloud(&inputs->normals_view, inputs->mesh.vertices.count) == 0
+          && CreateArena(&inputs->frame, "frame", frame_arena_size(&inputs->mesh)) == 0
+          && create_rasterizer(&inputs->rasterizer, &inputs->mesh, &inputs->frame) == 0;
+    if (!ok) return -1;
+    initialize_cube(inputs->points, point_count);
+    point_cloud_from_points(&inputs->model, inputs->points, point_count);
+    return 0;
+}
+
+void destroy_kernel_inputs(struct KernelInputs* inputs) {
+    destroy_rasterizer(&inputs->rasterizer);
+    DestroyArena(&inputs->frame);
+    destroy_point_cloud(&inputs->normals_view);
+    destroy_point_cloud(&inputs->mesh_view);
+    destroy_point_cloud(&inputs->view);
+    destroy_point_cloud(&inputs->model);
+    destroy_depth_buffer(&inputs->depth_buffer);
+    if (inputs->mesh_loaded) destroy_mesh(&inputs->mesh);
+    SDL_FreeSurface(inputs->surface);
+    free(inputs->points);
+}
+
+void orient_kernel_inputs(struct KernelInputs* inputs, struct Quaternion orientation) {
+    quaternion_to_matrix(orientation, inputs->rotation_matrix);
+    for (int i = 0; i < 3; i++)
+        for (int j = 0; j < 3; j++)
+            inputs->float_matrix[i][j] = (float) inputs->rotation_matrix[i][j];
+    transform_point_cloud(&inputs->model, &inputs->view, inputs->rotation_matrix);
+    transform_point_cloud(&inputs->mesh.vertices, &inputs->mesh_view, inputs->rotation_matrix);
+    transform_point_cloud(&inputs->mesh.normals, &inputs->normals_view, inputs->rotation_matrix);
+}
+
+// The kernels of run_microbench, which owns their inputs
+void run_kernels(struct KernelInputs* inputs, struct Microbench* bench) {
+    orient_kernel_inputs(inputs, quaternion_from_euler(0.5, 0.7, 0.2));
+
+    RunMicrobench(bench, "apply_rotation", apply_rotation_kernel, inputs, inputs->point_count, "point");
+    RunMicrobench(bench, "transform_points_scalar", transform_points_scalar_kernel, inputs, inputs->point_count, "point");
+#ifdef HAVE_X86_SIMD
+    if (SDL_HasSSE())
+        RunMicrobench(bench, "transform_points_sse", transform_points_sse_kernel, inputs, inputs->point_count, "point");
+    if (SDL_HasAVX())
+        RunMicrobench(bench, "transform_points_avx", transform_points_avx_kernel, inputs, inputs->point_count, "point");
+#endif
+    RunMicrobench(bench, "draw_point_cloud_depth", draw_point_cloud_depth_kernel, inputs, inputs->point_count, "point");
+    RunMicrobench(bench, "draw_mesh_edges", draw_mesh_edges_kernel, inputs, inputs->mesh.edge_count, "edge");
+    const char* names[2][2] = {{"draw_mesh_filled flat sse", "draw_mesh_filled gouraud sse"},
+                               {"draw_mesh_filled flat scalar", "draw_mesh_filled gouraud scalar"}};
+#ifdef HAVE_X86_SIMD
+    int first_shader = 0;
+#else
+    int first_shader = 1;
+#endif
+    for (int scalar = first_shader; scalar < 2; scalar++) {
+        inputs->rasterizer.scalar_shading = scalar;
+        for (inputs->gouraud = 0; inputs->gouraud < 2; inputs->gouraud++)
+            RunMicrobench(bench, names[scalar][inputs->gouraud], draw_mesh_filled_kernel, inputs, WIDTH * HEIGHT, "pixel");
+    }
+}
+
+// Times the point and mesh kernels at one fixed orientation: the per point
+// reference rotation next to the batched ones, and both block shaders
+int run_microbench(int point_count, const char* model_path, const char* json_path, const char* filter) {
+    static struct KernelInputs inputs;
+    struct WorkerPool pool;
+    struct Microbench bench;
+    SDL_zero(pool);
+    int ok = create_kernel_inputs(&inputs, &pool, point_count, model_path) == 0
+          && CreateWorkerPool(&pool, SDL_GetCPUCount()) == 0
+          && OpenMicrobench(&bench, "cube", json_path, filter) == 0;
+    if (!ok) {
+        SDL_Log("Micro-benchmark setup failed");
+    } else {
+        run_kernels(&inputs, &bench);
+        CloseMicrobench(&bench);
+    }
+
+    destroy_kernel_inputs(&inputs);
+    DestroyWorkerPool(&pool);
+    return ok ? 0 : 1;
+}
+
+// Test cases of --test, each gets fresh kernel inputs from set_up_test: the
+// default cube sampled with DEFAULT_POINTS, seen after TEST_STEPS steps of
+// the demo rotation
+#define TEST_THREADS 3
+#define TEST_STEPS 60
+
+struct TestFixture {
+    struct WorkerPool pool;
+    struct KernelInputs inputs;
+    SDL_Surface* reference;
+};
+
+static struct TestFixture fixture;
+
+void set_up_test(void* arg) {
+    SDL_zero(fixture.pool);
+    int result = create_kernel_inputs(&fixture.inputs, &fixture.pool, DEFAULT_POINTS, "");
+    result |= CreateWorkerPool(&fixture.pool, TEST_THREADS);
+    fixture.reference = SDL_CreateRGBSurfaceWithFormat(0, WIDTH, HEIGHT, 32, SDL_PIXELFORMAT_XRGB8888);
+    SDLTest_AssertCheck(result == 0 && fixture.reference, "Test setup");
+    struct Quaternion rotation_step = quaternion_from_euler(0.01, 0.02, 0.03);
+    struct Quaternion orientation = {1, 0, 0, 0};
+    for (int i = 0; i < TEST_STEPS; i++)
+        orientation = quaternion_normalize(quaternion_multiply(rotation_step, orientation));
+    if (result == 0) orient_kernel_inputs(&fixture.inputs, orientation);
+}
+
+void tear_down_test(void* arg) {
+    SDL_FreeSurface(fixture.reference);
+    destroy_kernel_inputs(&fixture.inputs);
+    DestroyWorkerPool(&fixture.pool);
+}
+
+// One frame of render_mode into surface, the way main draws it
+void render_test_scene(SDL_Surface* surface, enum RenderMode render_mode) {
+    struct KernelInputs* inputs = &fixture.inputs;
+    SDL_Rect black_screen_rect = (SDL_Rect) {0, 0, WIDTH, HEIGHT};
+    SDL_FillRect(surface, &black_screen_rect, COLOR_BLACK);
+    clear_depth_buffer(&inputs->depth_buffer, FAR_PLANE);
+    ResetArena(&inputs->frame);
+    if (render_mode == RENDER_POINTS)
+        draw_point_cloud_depth(surface, &inputs->depth_buffer, &inputs->camera, &inputs->view);
+    else if (render_mode == RENDER_EDGES)
+        draw_mesh_edges(surface, &inputs->depth_buffer, &inputs->camera, &inputs->mesh, &inputs->mesh_view, COLOR_EDGE);
+    else
+        draw_mesh_filled(inputs->pool, &inputs->rasterizer, surface, &inputs->depth_buffer, &inputs->camera,
+                         &inputs->mesh, &inputs->mesh_view, &inputs->normals_view, COLOR_MESH, render_mode == RENDER_GOURAUD);
+}
+
+int check_test_scene(const char* name, enum RenderMode render_mode) {
+    char md5[GOLDEN_VALUE_LENGTH];
+    render_test_scene(fixture.inputs.surface, render_mode);
+    SurfaceMd5(fixture.inputs.surface, md5);
+    CheckGolden("cube", name, md5);
+    return TEST_COMPLETED;
+}
+
+int test_scene_flat(void* arg) {
+    return check_test_scene("flat", RENDER_FLAT);
+}
+
+int test_scene_gouraud(void* arg) {
+    return check_test_scene("gouraud", RENDER_GOURAUD);
+}
+
+int test_scene_edges(void* arg) {
+    return check_test_scene("edges", RENDER_EDGES);
+}
+
+int test_scene_points(void* arg) {
+    return check_test_scene("points", RENDER_POINTS);
+}
+
+int compare_point_clouds(const struct PointCloud* a, const struct PointCloud* b) {
+    size_t size = a->count * sizeof(float);
+    return SDL_memcmp(a->x, b->x, size) == 0 && SDL_memcmp(a->y, b->y, size) == 0 && SDL_memcmp(a->z, b->z, size) == 0;
+}
+
+// The batched transforms round like the scalar one, so they match exactly
+int test_transform_points(void* arg) {
+#ifdef HAVE_X86_SIMD
+    struct KernelInputs* inputs = &fixture.inputs;
+    struct PointCloud batched;
+    if (!SDL_HasSSE()) return TEST_SKIPPED;
+    if (!SDLTest_AssertCheck(create_point_cloud(&batched, inputs->point_count) == 0, "Point cloud allocation")) return TEST_ABORTED;
+    transform_points_scalar(&inputs->model, &inputs->view, inputs->float_matrix);
+    transform_points_sse(&inputs->model, &batched, inputs->float_matrix);
+    SDLTest_AssertCheck(compare_point_clouds(&inputs->view, &batched), "transform_points_sse matches transform_points_scalar");
+    if (SDL_HasAVX()) {
+        transform_points_avx(&inputs->model, &batched, inputs->float_matrix);
+        SDLTest_AssertCheck(compare_point_clouds(&inputs->view, &batched), "transform_points_avx matches transform_points_scalar");
+    }
+    destroy_point_cloud(&batched);
+    return TEST_COMPLETED;
+#else
+    return TEST_SKIPPED;
+#endif
+}
+
+// SSE block shading against shade_block_scalar, flat and gouraud
+int test_shade_block(void* arg) {
+#ifdef HAVE_X86_SIMD
+    for (int gouraud = 0; gouraud < 2; gouraud++) {
+        int lit;
+        fixture.inputs.rasterizer.scalar_shading = 1;
+        render_test_scene(fixture.reference, gouraud ? RENDER_GOURAUD : RENDER_FLAT);
+        fixture.inputs.rasterizer.scalar_shading = 0;
+        render_test_scene(fixture.inputs.surface, gouraud ? RENDER_GOURAUD : RENDER_FLAT);
+        int different = CountDifferentPixels(fixture.reference, fixture.inputs.surface, 0, &lit);
+        SDLTest_AssertCheck(different == 0, "%s shade_block_sse matches shade_block_scalar, %d of %d lit pixels differ",
+                            gouraud ? "gouraud" : "flat", different, lit);
     }
+    return TEST_COMPLETED;
+#else
+    return TEST_SKIPPED;
+#endif
+}
+
+// Tiles own their pixels, the thread count must not show in the image
+int test_rasterizer_threads(void* arg) {
+    struct WorkerPool single;
+    if (!SDLTest_AssertCheck(CreateWorkerPool(&single, 1) == 0, "Single thread pool")) return TEST_ABORTED;
+    fixture.inputs.pool = &single;
+    render_test_scene(fixture.reference, RENDER_GOURAUD);
+    fixture.inputs.pool = &fixture.pool;
+    DestroyWorkerPool(&single);
+    render_test_scene(fixture.inputs.surface, RENDER_GOURAUD);
+    int lit;
+    int different = CountDifferentPixels(fixture.reference, fixture.inputs.surface, 0, &lit);
+    SDLTest_AssertCheck(different == 0, "%d threads match one thread, %d pixels differ", TEST_THREADS, different);
+    return TEST_COMPLETED;
+}
+
+// Alignment, exhaustion and the growth at reset of the frame arena
+int test_frame_arena(void* arg) {
+    struct Arena arena;
+    if (!SDLTest_AssertCheck(CreateArena(&arena, "test", 256) == 0, "Arena allocation")) return TEST_ABORTED;
+    Uint8* first = ArenaAlloc(&arena, 10);
+    Uint8* second = ArenaAlloc(&arena, 100);
+    SDLTest_AssertCheck(first && second && second - first == ARENA_ALIGNMENT, "Allocations packed at ARENA_ALIGNMENT");
+    SDLTest_AssertCheck(((uintptr_t) first & (ARENA_ALIGNMENT - 1)) == 0, "Allocations aligned");
+    SDLTest_AssertCheck(ArenaAlloc(&arena, 200) == NULL, "Allocation beyond the arena fails");
+    SDLTest_AssertCheck(ResetArena(&arena) == 0 && arena.used == 0, "Reset releases everything");
+    SDLTest_AssertCheck(arena.high_water == ArenaSize(100 + ARENA_ALIGNMENT) + ArenaSize(200), "High water counts the failed allocation, %zu bytes", arena.high_water);
+    SDLTest_AssertCheck(arena.size >= arena.high_water, "Reset grows the arena to %zu bytes", arena.size);
+    Uint8* zeroed = ArenaAllocZeroed(&arena, 100);
+    int zero = zeroed && ArenaAlloc(&arena, 200);
+    for (int i = 0; zero && i < 100; i++) zero = zeroed[i] == 0;
+    SDLTest_AssertCheck(zero, "The grown arena holds the frame that failed, zeroed allocations are zero");
+    DestroyArena(&arena);
+    return TEST_COMPLETED;
+}
+
+// A frame arena too small for the bins grows within the frame, before the
+// bins are allocated, and the frame still draws the golden image
+int test_small_frame_arena(void* arg) {
+    struct KernelInputs* inputs = &fixture.inputs;
+    DestroyArena(&inputs->frame);
+    if (!SDLTest_AssertCheck(CreateArena(&inputs->frame, "frame", ARENA_ALIGNMENT) == 0, "Arena allocation")) return TEST_ABORTED;
+    check_test_scene("flat", RENDER_FLAT);
+    SDLTest_AssertCheck(inputs->frame.size > ARENA_ALIGNMENT && inputs->frame.demand == 0, "The %d byte arena grew to %zu bytes, no allocation failed",
+                        ARENA_ALIGNMENT, inputs->frame.size);
+    return TEST_COMPLETED;
+}
+
+// Counts that are no multiple of 12 still put every point on a cube edge
+int test_initialize_cube(void* arg) {
+    int count = DEFAULT_POINTS + 7;
+    struct Point* points = SDL_malloc(count * sizeof(struct Point));
+    if (!SDLTest_AssertCheck(points != NULL, "Point allocation")) return TEST_ABORTED;
+    // NaN in every coordinate a point left unwritten would keep
+    SDL_memset(points, 0xff, count * sizeof(struct Point));
+    initialize_cube(points, count);
+    int on_edges = 0;
+    for (int i = 0; i < count; i++) {
+        double coordinates[3] = {points[i].x, points[i].y, points[i].z};
+        int at_faces = 0, inside = 1;
+        for (int k = 0; k < 3; k++) {
+            at_faces += SDL_fabs(coordinates[k]) == 100;
+            inside = inside && SDL_fabs(coordinates[k]) <= 100;
+        }
+        on_edges += inside && at_faces >= 2;
+    }
+    SDLTest_AssertCheck(on_edges == count, "%d of %d points on a cube edge", on_edges, count);
+    SDL_free(points);
+    return TEST_COMPLETED;
+}
+
+static const SDLTest_TestCaseReference scene_flat_test = {test_scene_flat, "scene_flat", "Flat shaded cube", TEST_ENABLED};
+static const SDLTest_TestCaseReference scene_gouraud_test = {test_scene_gouraud, "scene_gouraud", "Gouraud shaded cube", TEST_ENABLED};
+static const SDLTest_TestCaseReference scene_edges_test = {test_scene_edges, "scene_edges", "Cube edges", TEST_ENABLED};
+static const SDLTest_TestCaseReference scene_points_test = {test_scene_points, "scene_points", "Cube point cloud", TEST_ENABLED};
+static const SDLTest_TestCaseReference transform_test = {test_transform_points, "transform_points", "SSE and AVX transforms against scalar", TEST_ENABLED};
+static const SDLTest_TestCaseReference shade_test = {test_shade_block, "shade_block", "SSE shading against scalar", TEST_ENABLED};
+static const SDLTest_TestCaseReference threads_test = {test_rasterizer_threads, "rasterizer_threads", "Rasterizer on 1 and several threads", TEST_ENABLED};
+static const SDLTest_TestCaseReference arena_test = {test_frame_arena, "frame_arena", "Frame arena allocation and reset", TEST_ENABLED};
+static const SDLTest_TestCaseReference small_arena_test = {test_small_frame_arena, "small_frame_arena", "Flat shaded cube from an overflowing frame arena", TEST_ENABLED};
+static const SDLTest_TestCaseReference initialize_cube_test = {test_initialize_cube, "initialize_cube", "Cube sampled with a count that is no multiple of 12", TEST_ENABLED};
+
+static const SDLTest_TestCaseReference* scene_tests[] = {
+    &scene_flat_test, &scene_gouraud_test, &scene_edges_test, &scene_points_test, NULL
+};
+static const SDLTest_TestCaseReference* kernel_tests[] = {
+    &initialize_cube_test, &transform_test, &shade_test, &threads_test, &arena_test, &small_arena_test, NULL
+};
+static SDLTest_TestSuiteReference scene_suite = {"scenes", set_up_test, scene_tests, tear_down_test};
+static SDLTest_TestSuiteReference kernel_suite = {"kernels", set_up_test, kernel_tests, tear_down_test};
+static SDLTest_TestSuiteReference* test_suites[] = {&scene_suite, &kernel_suite, NULL};
+
+// cube [--points N] [--offscreen frames] [--output file.bmp]
+//      [--microbench] [--json file] [--kernel name-prefix]
+//      [--test] [--update-golden] [--golden file] [--filter name]
+//      [--profile] [--trace file.json] [--memory-debug] [model.obj]
+// Returns -1 on an unknown option or a second model path
+int parse_options(int argc, char* argv[], struct Options* options) {
+    options->point_count = DEFAULT_POINTS;
+    options->model_path[0] = 0;
+    SDL_zero(options->display);
+    options->microbench = 0;
+    SDL_strlcpy(options->json_path, MICROBENCH_JSON, sizeof(options->json_path));
+    options->kernel_filter[0] = 0;
+    SDL_zero(options->test);
+    SDL_zero(options->profile);
+    options->memory_debug = 0;
+
+    int result = 0;
+    struct Arguments arguments;
+    InitArguments(&arguments, argc, argv);
+    for (const char* argument = NextArgument(&arguments); argument && result == 0; argument = NextArgument(&arguments)) {
+        if (ParseDisplayOption(argument, &arguments, &options->display)) continue;
+        if (ParseTestOption(argument, &arguments, &options->test)) continue;
+        if (ParseProfileOption(argument, &arguments, &options->profile)) continue;
+        if (SDL_strcmp(argument, "--points") == 0) {
+            const char* count = NextArgument(&arguments);
+            options->point_count = SDL_clamp(count ? SDL_atoi(count) : DEFAULT_POINTS, MIN_POINTS, MAX_POINTS);
+        } else if (SDL_strcmp(argument, "--microbench") == 0) {
+            options->microbench = 1;
+        } else if (SDL_strcmp(argument, "--json") == 0) {
+            const char* path = NextArgument(&arguments);
+            if (path) SDL_strlcpy(options->json_path, path, sizeof(options->json_path));
+        } else if (SDL_strcmp(argument, "--kernel") == 0) {
+            const char* name = NextArgument(&arguments);
+            if (name) SDL_strlcpy(options->kernel_filter, name, sizeof(options->kernel_filter));
+        } else if (SDL_strcmp(argument, "--memory-debug") == 0) {
+            options->memory_debug = 1;
+        } else if (SDL_strncmp(argument, "--", 2) == 0) {
+            SDL_Log("Unknown option %s", argument);
+            result = -1;
+        } else if (options->model_path[0]) {
+            SDL_Log("More than one model: %s and %s", options->model_path, argument);
+            result = -1;
+        } else {
+            SDL_strlcpy(options->model_path, argument, sizeof(options->model_path));
+        }
+    }
+    return result;
+}
+
+int main(int argc, char* argv[]) {
+    struct Options options;
+    if (parse_options(argc, argv, &options) != 0) return 1;
+    if (options.memory_debug) EnableMemoryDebug();
 
-    SDL_Window* window = SDL_CreateWindow("3D Cube", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, WIDTH, HEIGHT, SDL_WINDOW_BORDERLESS);
-    if (!window) {
-        MessageBox(NULL, "Window creation failed", "Error", MB_OK | MB_ICONERROR);
+    if (options.test.run)
+        return RunTests(test_suites, &options.test);
+    if (options.microbench)
+        return run_microbench(options.point_count, options.model_path, options.json_path, options.kernel_filter);
+
+    struct Display display;
+    SDL_Surface* surface = NULL;
+    if (CreateDisplay(&display, "3D Cube", WIDTH, HEIGHT, SDL_WINDOW_BORDERLESS, &options.display) != 0 || !(surface = GetDisplaySurface(&display))) {
+        SDL_Log("Display setup failed: %s", SDL_GetError());
+        DestroyDisplay(&display);
         SDL_Quit();
         return 1;
     }
 
-    SDL_Surface* surface = SDL_GetWindowSurface(window);
-    if (!surface) {
-        MessageBox(NULL, "Failed to get window surface", "Error", MB_OK | MB_ICONERROR);
-        SDL_DestroyWindow(window);
+    int number_of_points = options.point_count;
+    struct Camera camera = {CAMERA_DISTANCE, FOCAL_LENGTH, NEAR_PLANE, FAR_PLANE};
+    struct DepthBuffer depth_buffer;
+    if (surface->format->BytesPerPixel != 4 || create_depth_buffer(&depth_buffer, WIDTH, HEIGHT) != 0) {
+        SDL_Log("Depth buffer setup failed");
+        DestroyDisplay(&display);
         SDL_Quit();
         return 1;
     }
 
-    int number_of_points = 1200;
-    struct Point points[number_of_points];
+    // the sampled points and both clouds share one arena; model stays
+    // untouched, view receives the rotated copy every frame
+    struct Arena arena;
+    struct PointCloud model, view;
+    struct Point* points = NULL;
+    size_t points_size = (size_t) number_of_points * sizeof(struct Point);
+    if (CreateArena(&arena, "points", ArenaSize(points_size) + 2 * arena_point_cloud_size(number_of_points)) == 0) {
+        points = ArenaAlloc(&arena, points_size);
+    }
+    if (!points || arena_point_cloud(&arena, &model, number_of_points) != 0 || arena_point_cloud(&arena, &view, number_of_points) != 0) {
+        SDL_Log("Point cloud allocation failed");
+        DestroyArena(&arena);
+        destroy_depth_buffer(&depth_buffer);
+        DestroyDisplay(&display);
+        SDL_Quit();
+        return 1;
+    }
     initialize_cube(points, number_of_points);
-    draw_points_3d(surface, points, number_of_points);
+    point_cloud_from_points(&model, points, number_of_points);
+
+    // an OBJ file on the command line replaces the cube mesh
+    struct Mesh mesh;
+    struct PointCloud mesh_view, normals_view;
+    int mesh_ok = (options.model_path[0] ? load_obj_mesh(&mesh, options.model_path, OBJ_RADIUS) : create_cube_mesh(&mesh, CUBE_SIDE_LENGTH)) == 0;
+    int mesh_view_ok = mesh_ok && create_point_cloud(&mesh_view, mesh.vertices.count) == 0;
+    int normals_view_ok = mesh_ok && create_point_cloud(&normals_view, mesh.vertices.count) == 0;
+    // bins of the rasterizer, released at the end of every frame
+    struct Arena frame_arena;
+    int frame_arena_ok = mesh_ok && CreateArena(&frame_arena, "frame", frame_arena_size(&mesh)) == 0;
+    struct Rasterizer rasterizer;
+    int rasterizer_ok = frame_arena_ok && create_rasterizer(&rasterizer, &mesh, &frame_arena) == 0;
+    if (!mesh_view_ok || !normals_view_ok || !rasterizer_ok) {
+        SDL_Log("Failed to load model");
+        if (rasterizer_ok) destroy_rasterizer(&rasterizer);
+        if (frame_arena_ok) DestroyArena(&frame_arena);
+        if (mesh_ok) destroy_mesh(&mesh);
+        if (mesh_view_ok) destroy_point_cloud(&mesh_view);
+        if (normals_view_ok) destroy_point_cloud(&normals_view);
+        DestroyArena(&arena);
+        destroy_depth_buffer(&depth_buffer);
+        DestroyDisplay(&display);
+        SDL_Quit();
+        return 1;
+    }
+    // the calling thread rasterizes too, so one thread per core
+    struct WorkerPool pool;
+    CreateWorkerPool(&pool, SDL_GetCPUCount());
+    // m cycles through the render modes
+    enum RenderMode render_mode = RENDER_FLAT;
 
     SDL_Rect black_screen_rect = (SDL_Rect) {0, 0, WIDTH, HEIGHT};
     SDL_Event event;
     double alpha = 0.01;
     double beta = 0.02;
     double gamma = 0.03;
+    // the orientation accumulates the per-step rotation and is renormalized,
+    // so rounding errors never reach the shape of the model; frames draw
+    // the blend of the last two steps
+    struct Quaternion rotation_step = quaternion_from_euler(alpha, beta, gamma);
+    struct Quaternion orientation = {1, 0, 0, 0};
+    struct Quaternion previous_orientation = orientation;
+    struct FrameLoop loop;
+    InitFrameLoop(&loop, STEP_RATE, DisplayFrameRate(display.window));
+    if (display.offscreen) UseFixedSteps(&loop, 1);
+    double rotation_matrix[3][3];
+    // transform and plot time of the point cloud, logged as throughput
+    Uint64 transform_ticks = 0, plot_ticks = 0;
+    int timed_frames = 0;
+    InitProfiler(&options.profile);
     int is_running = 1;
     while (is_running) {
         while(SDL_PollEvent(&event)) {
+            if (HandleProfileEvent(&event)) continue;
             if (event.key.keysym.sym == SDLK_SPACE) {
                 is_running = 0;
             }
+            if (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_m) {
+                render_mode = (render_mode + 1) % RENDER_MODE_COUNT;
+            }
+        }
+        ProfileBegin("simulate");
+        for (int steps = BeginFrame(&loop); steps > 0; steps--) {
+            previous_orientation = orientation;
+            orientation = quaternion_normalize(quaternion_multiply(rotation_step, orientation));
         }
+        quaternion_to_matrix(quaternion_nlerp(previous_orientation, orientation, FrameAlpha(&loop)), rotation_matrix);
+        ProfileEnd();
+        ProfileBegin("clear");
         SDL_FillRect(surface, &black_screen_rect, COLOR_BLACK);
-        for (int i = 0; i < number_of_points; i++)
-            apply_rotation(&points[i], alpha, beta, gamma);
-        draw_points_3d(surface, points, number_of_points);
-
-        SDL_UpdateWindowSurface(window);
+        clear_depth_buffer(&depth_buffer, FAR_PLANE);
+        ProfileEnd();
+        ProfileBegin("rasterize");
+        if (render_mode == RENDER_POINTS) {
+            Uint64 start = SDL_GetPerformanceCounter();
+            transform_point_cloud(&model, &view, rotation_matrix);
+            Uint64 transformed = SDL_GetPerformanceCounter();
+            draw_point_cloud_depth(surface, &depth_buffer, &camera, &view);
+            transform_ticks += transformed - start;
+            plot_ticks += SDL_GetPerformanceCounter() - transformed;
+            if (++timed_frames == THROUGHPUT_FRAMES) {
+                double million_point_ticks = (double) number_of_points * timed_frames * SDL_GetPerformanceFrequency() / 1e6;
+                SDL_Log("%d points: transform %.1f Mpoints/s, plot %.1f Mpoints/s", number_of_points,
+                        million_point_ticks / SDL_max(transform_ticks, 1), million_point_ticks / SDL_max(plot_ticks, 1));
+                transform_ticks = plot_ticks = 0;
+                timed_frames = 0;
+            }
+        } else if (render_mode == RENDER_EDGES) {
+            transform_point_cloud(&mesh.vertices, &mesh_view, rotation_matrix);
+            draw_mesh_edges(surface, &depth_buffer, &camera, &mesh, &mesh_view, COLOR_EDGE);
+        } else {
+            transform_point_cloud(&mesh.vertices, &mesh_view, rotation_matrix);
+            transform_point_cloud(&mesh.normals, &normals_view, rotation_matrix);
+            if (draw_mesh_filled(&pool, &rasterizer, surface, &depth_buffer, &camera, &mesh, &mesh_view, &normals_view, COLOR_MESH, render_mode == RENDER_GOURAUD) != 0)
+                is_running = 0;
+        }
+        ProfileEnd();
 
-        SDL_Delay(20);
+        DrawProfileOverlay(surface);
+        ProfileBegin("present");
+        if (!PresentDisplay(&display)) is_running = 0;
+        ProfileEnd();
+        EndFrame(&loop);
+        ProfileFrame();
+        if (ResetArena(&frame_arena) != 0) is_running = 0;
     } 
     
-    SDL_DestroyWindow(window);
+    ShutdownProfiler();
+    ReportArena(&frame_arena);
+    destroy_rasterizer(&rasterizer);
+    DestroyArena(&frame_arena);
+    DestroyArena(&arena);
+    destroy_mesh(&mesh);
+    destroy_point_cloud(&mesh_view);
+    destroy_point_cloud(&normals_view);
+    DestroyWorkerPool(&pool);
+    destroy_depth_buffer(&depth_buffer);
+    DestroyDisplay(&display);
     SDL_Quit();
 
     return 0;
@@ -0,0 +1,74 @@
+#include "frame_loop.h"
+
+void InitFrameLoop(struct FrameLoop* loop, int step_rate, int frame_rate) {
+    SDL_zerop(loop);
+    loop->frequency = SDL_GetPerformanceFrequency();
+    loop->step_ticks = loop->frequency / SDL_max(step_rate, 1);
+    loop->frame_ticks = frame_rate > 0 ? loop->frequency / frame_rate : 0;
+    loop->previous = SDL_GetPerformanceCounter();
+    loop->deadline = loop->previous + loop->frame_ticks;
+    loop->report_start = loop->previous;
+}
+
+void UseFixedSteps(struct FrameLoop* loop, int steps) {
+    loop->fixed_steps = steps;
+    loop->frame_ticks = 0;
+}
+
+int DisplayFrameRate(SDL_Window* window) {
+    SDL_DisplayMode mode;
+    int display = SDL_GetWindowDisplayIndex(window);
+    if (display < 0 || SDL_GetCurrentDisplayMode(display, &mode) != 0 || mode.refresh_rate <= 0)
+        return FRAME_DEFAULT_RATE;
+    return mode.refresh_rate;
+}
+
+int BeginFrame(struct FrameLoop* loop) {
+    if (loop->fixed_steps) return loop->fixed_steps;
+    Uint64 now = SDL_GetPerformanceCounter();
+    loop->accumulator += now - loop->previous;
+    loop->previous = now;
+    Uint64 steps = loop->accumulator / loop->step_ticks;
+    if (steps > FRAME_MAX_STEPS) {
+        // catching up would only make the next frame later still
+        loop->dropped_steps += (int) (steps - FRAME_MAX_STEPS);
+        steps = FRAME_MAX_STEPS;
+    }
+    loop->accumulator = loop->accumulator % loop->step_ticks;
+    return (int) steps;
+}
+
+double FrameAlpha(const struct FrameLoop* loop) {
+    if (loop->fixed_steps) return 1;
+    return (double) loop->accumulator / loop->step_ticks;
+}
+
+void EndFrame(struct FrameLoop* loop) {
+    Uint64 now = SDL_GetPerformanceCounter();
+    loop->frames++;
+    if (loop->frame_ticks) {
+        if (now > loop->deadline) {
+            // every whole frame period past the deadline is a refresh never shown
+            Uint64 missed = (now - loop->deadline) / loop->frame_ticks;
+            loop->late_frames++;
+            loop->dropped_frames += (int) missed;
+            loop->deadline += (missed + 1) * loop->frame_ticks;
+        } else {
+            double remaining = (double) (loop->deadline - now) / loop->frequency;
+            if (remaining > FRAME_SLEEP_MARGIN)
+                SDL_Delay((Uint32) ((remaining - FRAME_SLEEP_MARGIN) * 1000));
+            while (SDL_GetPerformanceCounter() < loop->deadline) {
+            }
+            loop->deadline += loop->frame_ticks;
+        }
+    }
+
+    now = SDL_GetPerformanceCounter();
+    if (now - loop->report_start >= FRAME_REPORT_INTERVAL * loop->frequency) {
+        if (loop->late_frames || loop->dropped_frames || loop->dropped_steps)
+            SDL_Log("%d frames: %d late, %d dropped, %d simulation steps skipped",
+                    loop->frames, loop->late_frames, loop->dropped_frames, loop->dropped_steps);
+        loop->frames = loop->late_frames = loop->dropped_frames = loop->dropped_steps = 0;
+        loop->report_start = now;
+    }
+}
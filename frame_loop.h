@@ -0,0 +1,51 @@
+#ifndef FRAME_LOOP_H
+#define FRAME_LOOP_H
+
+#include "SDL.h"
+
+// Most simulation steps run in one frame; a longer backlog is dropped
+#define FRAME_MAX_STEPS 8
+// Frames sleep until this close to their deadline and spin the rest
+#define FRAME_SLEEP_MARGIN 0.002
+#define FRAME_DEFAULT_RATE 60
+#define FRAME_REPORT_INTERVAL 5
+
+// Fixed timestep loop: real time from the performance counter fills an
+// accumulator that is drained in whole simulation steps; the remainder is
+// the interpolation factor between the last two simulation states.
+// Frames are paced to frame_ticks, or run unpaced when it is 0. With
+// fixed_steps every frame runs exactly that many steps instead, so offscreen
+// runs are reproducible.
+struct FrameLoop {
+    Uint64 frequency;
+    Uint64 step_ticks;
+    Uint64 frame_ticks;
+    Uint64 previous;
+    Uint64 accumulator;
+    Uint64 deadline;
+    Uint64 report_start;
+    int frames;
+    int late_frames;
+    int dropped_frames;
+    int dropped_steps;
+    int fixed_steps;
+};
+
+void InitFrameLoop(struct FrameLoop* loop, int step_rate, int frame_rate);
+
+// Unpaced frames of steps steps each, drawn at the latest step
+void UseFixedSteps(struct FrameLoop* loop, int steps);
+
+// Refresh rate of the display showing the window, FRAME_DEFAULT_RATE when unknown
+int DisplayFrameRate(SDL_Window* window);
+
+// Number of simulation steps due this frame
+int BeginFrame(struct FrameLoop* loop);
+
+// How far real time is past the last simulation step, in steps (0 .. 1)
+double FrameAlpha(const struct FrameLoop* loop);
+
+// Waits for the frame deadline and periodically logs late and dropped frames
+void EndFrame(struct FrameLoop* loop);
+
+#endif
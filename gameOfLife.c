@@ -1,9 +1,14 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
-#include <windows.h>
 #define SDL_MAIN_HANDLED
 #include "SDL.h"
+#include "platform.h"
+#include "microbench.h"
+#include "golden.h"
+#include "profiler.h"
+#include "arena.h"
 
 #define WIDTH 900
 #define HEIGHT 600
@@ -15,6 +20,9 @@
 
 #define ALIVE 1
 #define DEAD 0
+// offscreen runs start from this random pattern instead of an empty grid
+#define OFFSCREEN_SEED 1
+#define MICROBENCH_JSON "gameOfLife_microbench.json"
 
 #undef main
 
@@ -64,7 +72,7 @@ void handle_mouse_click(int* grid, int x, int y) {
 void save_pattern(const char* filename, int* grid) {
     FILE* file = fopen(filename, "w");
     if (!file) {
-        MessageBox(NULL, "Failed to save pattern!", "Error", MB_OK | MB_ICONERROR);
+        SDL_Log("Failed to save pattern!");
         return;
     }
 
@@ -80,7 +88,7 @@ void save_pattern(const char* filename, int* grid) {
 void load_pattern(const char* filename, int* grid) {
     FILE* file = fopen(filename, "r");
     if (!file) {
-        MessageBox(NULL, "Failed to load pattern", "Error", MB_OK | MB_ICONERROR);
+        SDL_Log("Failed to load pattern");
         return;
     }
 
@@ -109,25 +117,215 @@ void simulation_step(int* grid, int* buffer) {
     memcpy(grid, buffer, ROWS * COLS * sizeof(int));
 }
 
-int main() {
-    srand(time(NULL));
+// Fills about a third of the cells, the same pattern on every platform
+void randomize_grid(int* grid, unsigned int seed) {
+    for (int i = 0; i < ROWS * COLS; i++) {
+        seed = seed * 1664525u + 1013904223u;
+        grid[i] = (seed >> 24) % 3 == 0 ? ALIVE : DEAD;
+    }
+}
+
+struct KernelGrid {
+    int* start;
+    int* grid;
+    int* buffer;
+    int neighbors;
+};
+
+void count_neighbors_kernel(void* context) {
+    struct KernelGrid* kernel = context;
+    int neighbors = 0;
+    for (int i = 0; i < ROWS; i++)
+        for (int j = 0; j < COLS; j++)
+            neighbors += count_neighbors(i, j, kernel->grid);
+    kernel->neighbors = neighbors;
+}
 
-    if (SDL_Init(SDL_INIT_VIDEO) != 0) {
-        MessageBox(NULL, "SDL initialization failed", "Error", MB_OK | MB_ICONERROR);
+// every call advances the same starting pattern
+void simulation_step_kernel(void* context) {
+    struct KernelGrid* kernel = context;
+    memcpy(kernel->grid, kernel->start, ROWS * COLS * sizeof(int));
+    simulation_step(kernel->grid, kernel->buffer);
+}
+
+int run_microbench(const char* json_path, const char* filter) {
+    struct Microbench bench;
+    struct KernelGrid kernel;
+    kernel.start = malloc(ROWS * COLS * sizeof(int));
+    kernel.grid = malloc(ROWS * COLS * sizeof(int));
+    kernel.buffer = malloc(ROWS * COLS * sizeof(int));
+    if (!kernel.start || !kernel.grid || !kernel.buffer || OpenMicrobench(&bench, "gameOfLife", json_path, filter) != 0) {
+        SDL_Log("Micro-benchmark setup failed");
+        free(kernel.start); free(kernel.grid); free(kernel.buffer);
         return 1;
     }
+    randomize_grid(kernel.start, OFFSCREEN_SEED);
+    memcpy(kernel.grid, kernel.start, ROWS * COLS * sizeof(int));
 
-    SDL_Window* window = SDL_CreateWindow("Game of Life", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, WIDTH, HEIGHT, SDL_WINDOW_SHOWN);
-    if (!window) {
-        MessageBox(NULL, "Window creation failed", "Error", MB_OK | MB_ICONERROR);
-        SDL_Quit();
-        return 1;
+    RunMicrobench(&bench, "count_neighbors", count_neighbors_kernel, &kernel, ROWS * COLS, "cell");
+    RunMicrobench(&bench, "simulation_step", simulation_step_kernel, &kernel, ROWS * COLS, "cell");
+
+    CloseMicrobench(&bench);
+    free(kernel.start); free(kernel.grid); free(kernel.buffer);
+    return 0;
+}
+
+// Test cases of --test, each gets a fresh grid from set_up_test
+#define TEST_GENERATIONS 60
+
+struct TestFixture {
+    int* grid;
+    int* buffer;
+    SDL_Surface* surface;
+    SDL_Renderer* renderer;
+};
+
+static struct TestFixture fixture;
+
+void set_up_test(void* arg) {
+    fixture.grid = calloc(ROWS * COLS, sizeof(int));
+    fixture.buffer = calloc(ROWS * COLS, sizeof(int));
+    fixture.surface = SDL_CreateRGBSurfaceWithFormat(0, WIDTH, HEIGHT, 32, SDL_PIXELFORMAT_XRGB8888);
+    fixture.renderer = fixture.surface ? SDL_CreateSoftwareRenderer(fixture.surface) : NULL;
+    SDLTest_AssertCheck(fixture.grid && fixture.buffer && fixture.renderer, "Test setup");
+}
+
+void tear_down_test(void* arg) {
+    if (fixture.renderer) SDL_DestroyRenderer(fixture.renderer);
+    SDL_FreeSurface(fixture.surface);
+    free(fixture.grid);
+    free(fixture.buffer);
+    SDL_zero(fixture);
+}
+
+// The offscreen run: TEST_GENERATIONS generations of the random start
+void run_test_generations(void) {
+    randomize_grid(fixture.grid, OFFSCREEN_SEED);
+    for (int i = 0; i < TEST_GENERATIONS; i++)
+        simulation_step(fixture.grid, fixture.buffer);
+}
+
+int test_grid_state(void* arg) {
+    char crc[GOLDEN_VALUE_LENGTH];
+    run_test_generations();
+    BufferCrc32(fixture.grid, ROWS * COLS * sizeof(int), crc);
+    CheckGolden("gameOfLife", "grid", crc);
+    return TEST_COMPLETED;
+}
+
+int test_scene_grid(void* arg) {
+    char md5[GOLDEN_VALUE_LENGTH];
+    run_test_generations();
+    SDL_SetRenderDrawColor(fixture.renderer, 0, 0, 0, 255);
+    SDL_RenderClear(fixture.renderer);
+    render_game_matrix(fixture.renderer, fixture.grid);
+    draw_grid(fixture.renderer);
+    SDL_RenderPresent(fixture.renderer);
+    SurfaceMd5(fixture.surface, md5);
+    CheckGolden("gameOfLife", "frame", md5);
+    return TEST_COMPLETED;
+}
+
+// Still lifes stay, a blinker flips with period 2 and a glider moves one
+// cell diagonally every 4 generations, also against the grid edges
+int test_simulation_rules(void* arg) {
+    int* grid = fixture.grid;
+    const int block[][2] = {{10, 10}, {10, 11}, {11, 10}, {11, 11}};
+    const int blinker[][2] = {{20, 20}, {20, 21}, {20, 22}};
+    const int glider[][2] = {{30, 31}, {31, 32}, {32, 30}, {32, 31}, {32, 32}};
+    for (int k = 0; k < 4; k++) grid[block[k][0] * COLS + block[k][1]] = ALIVE;
+    for (int k = 0; k < 3; k++) grid[blinker[k][0] * COLS + blinker[k][1]] = ALIVE;
+    for (int k = 0; k < 5; k++) grid[glider[k][0] * COLS + glider[k][1]] = ALIVE;
+    // a lone cell in the corner dies without touching the other side
+    grid[0] = ALIVE;
+
+    simulation_step(grid, fixture.buffer);
+    SDLTest_AssertCheck(grid[19 * COLS + 21] && grid[20 * COLS + 21] && grid[21 * COLS + 21] && !grid[20 * COLS + 20],
+                        "Blinker turns vertical");
+    SDLTest_AssertCheck(!grid[0] && !grid[ROWS * COLS - 1], "Corner cell dies");
+    for (int i = 1; i < 4; i++) simulation_step(grid, fixture.buffer);
+
+    int alive = 0, still = 1, moved = 1;
+    for (int i = 0; i < ROWS * COLS; i++) alive += grid[i];
+    for (int k = 0; k < 4; k++) still &= grid[block[k][0] * COLS + block[k][1]];
+    for (int k = 0; k < 5; k++) moved &= grid[(glider[k][0] + 1) * COLS + glider[k][1] + 1];
+    SDLTest_AssertCheck(still, "Block stays");
+    SDLTest_AssertCheck(grid[20 * COLS + 20] && grid[20 * COLS + 21] && grid[20 * COLS + 22], "Blinker is back after 4 generations");
+    SDLTest_AssertCheck(moved, "Glider moved one cell down and right");
+    SDLTest_AssertCheck(alive == 4 + 3 + 5, "%d cells alive, expected 12", alive);
+    return TEST_COMPLETED;
+}
+
+static const SDLTest_TestCaseReference grid_state_test = {test_grid_state, "grid_state", "Grid after the offscreen generations", TEST_ENABLED};
+static const SDLTest_TestCaseReference scene_grid_test = {test_scene_grid, "scene_grid", "Rendered grid", TEST_ENABLED};
+static const SDLTest_TestCaseReference rules_test = {test_simulation_rules, "simulation_rules", "Known patterns", TEST_ENABLED};
+
+static const SDLTest_TestCaseReference* scene_tests[] = {&grid_state_test, &scene_grid_test, NULL};
+static const SDLTest_TestCaseReference* kernel_tests[] = {&rules_test, NULL};
+static SDLTest_TestSuiteReference scene_suite = {"scenes", set_up_test, scene_tests, tear_down_test};
+static SDLTest_TestSuiteReference kernel_suite = {"kernels", set_up_test, kernel_tests, tear_down_test};
+static SDLTest_TestSuiteReference* test_suites[] = {&scene_suite, &kernel_suite, NULL};
+
+struct Options {
+    struct DisplayOptions display;
+    int microbench;
+    char json_path[OUTPUT_PATH_LENGTH];
+    char kernel_filter[64];
+    struct TestOptions test;
+    struct ProfileOptions profile;
+    int memory_debug;
+};
+
+// gameOfLife [--offscreen generations] [--output file.bmp]
+//            [--microbench] [--json file] [--kernel name-prefix]
+//            [--test] [--update-golden] [--golden file] [--filter name]
+//            [--profile] [--trace file.json] [--memory-debug]
+void parse_options(int argc, char* argv[], struct Options* options) {
+    SDL_zero(options->display);
+    options->microbench = 0;
+    SDL_strlcpy(options->json_path, MICROBENCH_JSON, sizeof(options->json_path));
+    options->kernel_filter[0] = 0;
+    SDL_zero(options->test);
+    SDL_zero(options->profile);
+    options->memory_debug = 0;
+
+    struct Arguments arguments;
+    InitArguments(&arguments, argc, argv);
+    for (const char* argument = NextArgument(&arguments); argument; argument = NextArgument(&arguments)) {
+        if (ParseDisplayOption(argument, &arguments, &options->display)) continue;
+        if (ParseTestOption(argument, &arguments, &options->test)) continue;
+        if (ParseProfileOption(argument, &arguments, &options->profile)) continue;
+        if (SDL_strcmp(argument, "--microbench") == 0) {
+            options->microbench = 1;
+        } else if (SDL_strcmp(argument, "--json") == 0) {
+            const char* path = NextArgument(&arguments);
+            if (path) SDL_strlcpy(options->json_path, path, sizeof(options->json_path));
+        } else if (SDL_strcmp(argument, "--kernel") == 0) {
+            const char* name = NextArgument(&arguments);
+            if (name) SDL_strlcpy(options->kernel_filter, name, sizeof(options->kernel_filter));
+        } else if (SDL_strcmp(argument, "--memory-debug") == 0) {
+            options->memory_debug = 1;
+        }
     }
+}
 
-    SDL_Renderer* renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
-    if (!renderer) {
-        MessageBox(NULL, "Renderer creation failed", "Error", MB_OK | MB_ICONERROR);
-        SDL_DestroyWindow(window);
+int main(int argc, char* argv[]) {
+    srand(time(NULL));
+
+    struct Options options;
+    parse_options(argc, argv, &options);
+    if (options.memory_debug) EnableMemoryDebug();
+
+    if (options.test.run)
+        return RunTests(test_suites, &options.test);
+    if (options.microbench)
+        return run_microbench(options.json_path, options.kernel_filter);
+
+    struct Display display;
+    SDL_Renderer* renderer = NULL;
+    if (CreateDisplay(&display, "Game of Life", WIDTH, HEIGHT, SDL_WINDOW_SHOWN, &options.display) != 0 || !(renderer = CreateDisplayRenderer(&display))) {
+        SDL_Log("Display setup failed: %s", SDL_GetError());
+        DestroyDisplay(&display);
         SDL_Quit();
         return 1;
     }
@@ -135,22 +333,28 @@ int main() {
     int* grid = (int*)malloc(ROWS * COLS * sizeof(int));
     int* buffer = (int*)calloc(ROWS * COLS, sizeof(int)); 
     if (!grid || !buffer) {
-        MessageBox(NULL, "Memory allocation failed", "Error", MB_OK | MB_ICONERROR);
+        SDL_Log("Memory allocation failed");
         free(grid); free(buffer);
-        SDL_DestroyRenderer(renderer);
-        SDL_DestroyWindow(window);
+        DestroyDisplay(&display);
         SDL_Quit();
         return 1;
     }
 
     memset(grid, 0, ROWS * COLS * sizeof(int));
 
+    // offscreen every frame is one generation of a random start
     int running = 1, paused = 1;  
+    if (display.offscreen) {
+        randomize_grid(grid, OFFSCREEN_SEED);
+        paused = 0;
+    }
     SDL_Event event;
     Uint32 last_frame_time = SDL_GetTicks();
 
+    InitProfiler(&options.profile);
     while (running) {
         while (SDL_PollEvent(&event)) {
+            if (HandleProfileEvent(&event)) continue;
             if (event.type == SDL_QUIT) {
                 running = 0;  
             } else if (event.type == SDL_KEYDOWN) {
@@ -182,27 +386,37 @@ int main() {
             }
         }
 
+        ProfileBegin("simulate");
         if (!paused) {
             Uint32 current_time = SDL_GetTicks();
-            if (current_time - last_frame_time >= FRAME_DELAY) {
+            if (display.offscreen || current_time - last_frame_time >= FRAME_DELAY) {
                 simulation_step(grid, buffer);  //
                 last_frame_time = current_time;
             }
         }
+        ProfileEnd();
 
+        ProfileBegin("clear");
         SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255); 
         SDL_RenderClear(renderer);
+        ProfileEnd();
 
+        ProfileBegin("rasterize");
         render_game_matrix(renderer, grid);
         draw_grid(renderer);
+        ProfileEnd();
 
-        SDL_RenderPresent(renderer);
+        RenderProfileOverlay(renderer);
+        ProfileBegin("present");
+        if (!PresentDisplay(&display)) running = 0;
+        ProfileEnd();
+        ProfileFrame();
     }
 
+    ShutdownProfiler();
     free(grid);
     free(buffer);
-    SDL_DestroyRenderer(renderer);
-    SDL_DestroyWindow(window);
+    DestroyDisplay(&display);
     SDL_Quit();
 
     return 0;
@@ -0,0 +1,145 @@
+#include <stdio.h>
+#include "golden.h"
+
+struct GoldenEntry {
+    char program[GOLDEN_NAME_LENGTH];
+    char name[GOLDEN_NAME_LENGTH];
+    char value[GOLDEN_VALUE_LENGTH];
+};
+
+// The file of the running RunTests, the harness gives test cases no context
+static struct GoldenFile {
+    int update;
+    int changed;
+    int count;
+    struct GoldenEntry entries[GOLDEN_MAX_ENTRIES];
+} golden;
+
+int ParseTestOption(const char* argument, struct Arguments* arguments, struct TestOptions* options) {
+    if (SDL_strcmp(argument, "--test") == 0) {
+        options->run = 1;
+        return 1;
+    }
+    if (SDL_strcmp(argument, "--update-golden") == 0) {
+        options->run = 1;
+        options->update = 1;
+        return 1;
+    }
+    if (SDL_strcmp(argument, "--golden") == 0 || SDL_strcmp(argument, "--filter") == 0) {
+        const char* value = NextArgument(arguments);
+        if (value && argument[2] == 'g') SDL_strlcpy(options->golden_path, value, sizeof(options->golden_path));
+        if (value && argument[2] == 'f') SDL_strlcpy(options->filter, value, sizeof(options->filter));
+        return 1;
+    }
+    return 0;
+}
+
+static int LoadGolden(const char* path) {
+    FILE* file = fopen(path, "r");
+    if (!file) return -1;
+    char line[256];
+    while (fgets(line, sizeof(line), file) && golden.count < GOLDEN_MAX_ENTRIES) {
+        struct GoldenEntry* entry = &golden.entries[golden.count];
+        if (line[0] == '#') continue;
+        if (sscanf(line, "%63s %63s %47s", entry->program, entry->name, entry->value) == 3) golden.count++;
+    }
+    fclose(file);
+    return 0;
+}
+
+static int SaveGolden(const char* path) {
+    FILE* file = fopen(path, "w");
+    if (!file) return -1;
+    fprintf(file, "# Golden values of the --test modes, rewrite with --update-golden\n");
+    for (int i = 0; i < golden.count; i++)
+        fprintf(file, "%s %s %s\n", golden.entries[i].program, golden.entries[i].name, golden.entries[i].value);
+    fclose(file);
+    return 0;
+}
+
+int RunTests(SDLTest_TestSuiteReference* suites[], const struct TestOptions* options) {
+    const char* path = options->golden_path[0] ? options->golden_path : GOLDEN_DEFAULT_PATH;
+    SDL_zero(golden);
+    golden.update = options->update;
+    if (LoadGolden(path) != 0 && !options->update) SDL_Log("No golden values in %s, scene checks will fail", path);
+
+    int result = SDLTest_RunSuites(suites, NULL, 0, options->filter[0] ? options->filter : NULL, 1);
+    if (golden.changed) {
+        if (SaveGolden(path) == 0) {
+            SDL_Log("Updated %s", path);
+        } else {
+            SDL_Log("Could not write %s", path);
+            result = 1;
+        }
+    }
+    return result;
+}
+
+int CheckGolden(const char* program, const char* name, const char* value) {
+    struct GoldenEntry* entry = NULL;
+    for (int i = 0; i < golden.count && !entry; i++) {
+        if (SDL_strcmp(golden.entries[i].program, program) == 0 && SDL_strcmp(golden.entries[i].name, name) == 0)
+            entry = &golden.entries[i];
+    }
+    if (golden.update) {
+        if (!entry && golden.count < GOLDEN_MAX_ENTRIES) {
+            entry = &golden.entries[golden.count++];
+            SDL_strlcpy(entry->program, program, sizeof(entry->program));
+            SDL_strlcpy(entry->name, name, sizeof(entry->name));
+            entry->value[0] = 0;
+        }
+        if (entry && SDL_strcmp(entry->value, value) != 0) {
+            SDL_strlcpy(entry->value, value, sizeof(entry->value));
+            golden.changed = 1;
+        }
+        return SDLTest_AssertCheck(entry != NULL, "Recorded %s %s", name, value);
+    }
+    if (!entry) return SDLTest_AssertCheck(0, "Golden value of %s %s exists", program, name);
+    return SDLTest_AssertCheck(SDL_strcmp(entry->value, value) == 0, "%s is %s, golden %s", name, value, entry->value);
+}
+
+void SurfaceMd5(SDL_Surface* surface, char value[GOLDEN_VALUE_LENGTH]) {
+    SDLTest_Md5Context md5;
+    SDLTest_Md5Init(&md5);
+    // row by row, the pitch padding is not part of the image
+    int row_bytes = surface->w * surface->format->BytesPerPixel;
+    for (int y = 0; y < surface->h; y++)
+        SDLTest_Md5Update(&md5, (unsigned char*) surface->pixels + y * surface->pitch, row_bytes);
+    FinishMd5(&md5, value);
+}
+
+void FinishMd5(SDLTest_Md5Context* md5, char value[GOLDEN_VALUE_LENGTH]) {
+    SDLTest_Md5Final(md5);
+    SDL_strlcpy(value, "md5:", GOLDEN_VALUE_LENGTH);
+    for (int i = 0; i < 16; i++)
+        SDL_snprintf(&value[4 + i * 2], 3, "%02x", md5->digest[i]);
+}
+
+void BufferCrc32(const void* buffer, size_t size, char value[GOLDEN_VALUE_LENGTH]) {
+    SDLTest_Crc32Context crc;
+    CrcUint32 result = 0;
+    SDLTest_Crc32Init(&crc);
+    SDLTest_Crc32Calc(&crc, (CrcUint8*) buffer, (CrcUint32) size, &result);
+    SDLTest_Crc32Done(&crc);
+    SDL_snprintf(value, GOLDEN_VALUE_LENGTH, "crc32:%08x", (unsigned int) result);
+}
+
+int CountDifferentPixels(SDL_Surface* a, SDL_Surface* b, int tolerance, int* lit) {
+    int different = 0;
+    *lit = 0;
+    for (int y = 0; y < a->h; y++) {
+        const Uint8* row_a = (const Uint8*) a->pixels + y * a->pitch;
+        const Uint8* row_b = (const Uint8*) b->pixels + y * b->pitch;
+        for (int x = 0; x < a->w; x++) {
+            Uint32 pixel_a, pixel_b;
+            SDL_memcpy(&pixel_a, &row_a[x * 4], 4);
+            SDL_memcpy(&pixel_b, &row_b[x * 4], 4);
+            Uint8 r_a, g_a, b_a, r_b, g_b, b_b;
+            SDL_GetRGB(pixel_a, a->format, &r_a, &g_a, &b_a);
+            SDL_GetRGB(pixel_b, b->format, &r_b, &g_b, &b_b);
+            different += SDL_abs(r_a - r_b) > tolerance || SDL_abs(g_a - g_b) > tolerance || SDL_abs(b_a - b_b) > tolerance;
+            *lit += (r_a | g_a | b_a) != 0;
+        }
+    }
+    return different;
+}
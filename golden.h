@@ -0,0 +1,48 @@
+#ifndef GOLDEN_H
+#define GOLDEN_H
+
+#include "SDL.h"
+#include "SDL_test.h"
+#include "platform.h"
+
+#define GOLDEN_DEFAULT_PATH "tests/golden.txt"
+#define GOLDEN_MAX_ENTRIES 256
+#define GOLDEN_NAME_LENGTH 64
+#define GOLDEN_VALUE_LENGTH 48
+
+// Test options every program takes:
+//   --test               run the program's test suites and exit
+//   --golden file        golden values to compare with (tests/golden.txt)
+//   --update-golden      record the current values instead of comparing
+//   --filter name        only the suite or test case of that name
+struct TestOptions {
+    int run;
+    int update;
+    char golden_path[OUTPUT_PATH_LENGTH];
+    char filter[GOLDEN_NAME_LENGTH];
+};
+
+// Same contract as ParseDisplayOption
+int ParseTestOption(const char* argument, struct Arguments* arguments, struct TestOptions* options);
+
+// Loads the golden file, runs the suites through the SDL test harness and
+// writes the file back when --update-golden changed it. Returns 0 when all
+// tests passed.
+int RunTests(SDLTest_TestSuiteReference* suites[], const struct TestOptions* options);
+
+// The golden file holds one "program name value" line per rendered scene or
+// simulated state, values being "md5:<hex>" of a frame or "crc32:<hex>" of
+// raw state. Asserts value matches the line of program and name, or records
+// it with --update-golden.
+int CheckGolden(const char* program, const char* name, const char* value);
+
+void SurfaceMd5(SDL_Surface* surface, char value[GOLDEN_VALUE_LENGTH]);
+// Finalizes md5 and writes it as "md5:<hex>", for data hashed in pieces
+void FinishMd5(SDLTest_Md5Context* md5, char value[GOLDEN_VALUE_LENGTH]);
+void BufferCrc32(const void* buffer, size_t size, char value[GOLDEN_VALUE_LENGTH]);
+
+// Pixels of two equally sized 32-bit surfaces where a color channel differs
+// by more than tolerance; lit receives the pixels of a that are not black
+int CountDifferentPixels(SDL_Surface* a, SDL_Surface* b, int tolerance, int* lit);
+
+#endif
@@ -0,0 +1,82 @@
+#include "microbench.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#define HAVE_TSC 1
+#endif
+
+static int CompareDoubles(const void* a, const void* b) {
+    double x = *(const double*) a, y = *(const double*) b;
+    return (x > y) - (x < y);
+}
+
+double Median(double* values, int count) {
+    SDL_qsort(values, count, sizeof(double), CompareDoubles);
+    return values[count / 2];
+}
+
+int OpenMicrobench(struct Microbench* bench, const char* program, const char* json_path, const char* filter) {
+    SDL_zerop(bench);
+    SDL_strlcpy(bench->filter, filter ? filter : "", sizeof(bench->filter));
+    bench->filter_length = (int) SDL_strlen(bench->filter);
+    bench->json = fopen(json_path, "w");
+    if (!bench->json) return -1;
+    fprintf(bench->json, "{\n  \"program\": \"%s\",\n  \"samples\": %d,\n  \"results\": [", program, MICROBENCH_SAMPLES);
+    printf("%-40s %14s %10s %12s\n", "kernel", "ns/item", "mad", "cycles/item");
+    return 0;
+}
+
+void RunMicrobench(struct Microbench* bench, const char* name, void (*kernel)(void*), void* context, double items, const char* unit) {
+    if (SDL_strncmp(name, bench->filter, bench->filter_length) != 0) return;
+
+    // calls per sample, so a sample is well above the timer resolution
+    Uint64 frequency = SDL_GetPerformanceFrequency();
+    Uint64 start = SDL_GetPerformanceCounter();
+    for (int i = 0; i < MICROBENCH_WARMUP; i++) kernel(context);
+    double call_seconds = (double) (SDL_GetPerformanceCounter() - start) / frequency / MICROBENCH_WARMUP;
+    int calls = call_seconds > 0 ? (int) SDL_ceil(MICROBENCH_MIN_SAMPLE / call_seconds) : 1;
+    calls = SDL_max(calls, 1);
+
+    double ns[MICROBENCH_SAMPLES], cycles[MICROBENCH_SAMPLES];
+    for (int s = 0; s < MICROBENCH_SAMPLES; s++) {
+#ifdef HAVE_TSC
+        Uint64 tsc = __rdtsc();
+#endif
+        start = SDL_GetPerformanceCounter();
+        for (int i = 0; i < calls; i++) kernel(context);
+        Uint64 ticks = SDL_GetPerformanceCounter() - start;
+#ifdef HAVE_TSC
+        cycles[s] = (double) (__rdtsc() - tsc) / calls / items;
+#else
+        cycles[s] = 0;
+#endif
+        ns[s] = ticks * 1e9 / frequency / calls / items;
+    }
+
+    double median = Median(ns, MICROBENCH_SAMPLES);
+    double cycle_median = Median(cycles, MICROBENCH_SAMPLES);
+    for (int s = 0; s < MICROBENCH_SAMPLES; s++) ns[s] = SDL_fabs(ns[s] - median);
+    double mad = Median(ns, MICROBENCH_SAMPLES);
+
+    printf("%-40s %14.4f %10.4f %12.3f  per %s\n", name, median, mad, cycle_median, unit);
+    fprintf(bench->json, "%s\n    {\"kernel\": \"%s\", \"unit\": \"%s\", \"items\": %.0f, \"calls_per_sample\": %d, "
+        "\"median_ns\": %.6f, \"mad_ns\": %.6f",
+        bench->results ? "," : "", name, unit, items, calls, median, mad);
+#ifdef HAVE_TSC
+    // time stamp counter ticks, which match core cycles only at nominal clock
+    fprintf(bench->json, ", \"median_cycles\": %.6f", cycle_median);
+#endif
+    fprintf(bench->json, "}");
+    bench->results++;
+}
+
+void CloseMicrobench(struct Microbench* bench) {
+    if (!bench->json) return;
+    fprintf(bench->json, "\n  ]\n}\n");
+    fclose(bench->json);
+    bench->json = NULL;
+}
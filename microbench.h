@@ -0,0 +1,38 @@
+#ifndef MICROBENCH_H
+#define MICROBENCH_H
+
+#include <stdio.h>
+#include "SDL.h"
+
+// Untimed calls before measuring, also used to size the samples
+#define MICROBENCH_WARMUP 3
+// Samples per kernel; odd, so the median is one of them
+#define MICROBENCH_SAMPLES 31
+// A sample repeats the kernel until it takes at least this long
+#define MICROBENCH_MIN_SAMPLE 0.002
+
+// Kernel micro-benchmarks: each kernel is timed over MICROBENCH_SAMPLES
+// samples after a warmup, and reported as the median and median absolute
+// deviation per item (pixel, cell, point, ...). Results are printed and
+// written as JSON so runs of different commits can be compared.
+struct Microbench {
+    FILE* json;
+    int results;
+    int filter_length;
+    char filter[64];
+};
+
+// Writes the results to json_path; only kernels whose name starts with
+// filter are run (all when it is NULL or empty)
+int OpenMicrobench(struct Microbench* bench, const char* program, const char* json_path, const char* filter);
+
+// Times kernel(context), which processes items units of work per call
+void RunMicrobench(struct Microbench* bench, const char* name, void (*kernel)(void*), void* context, double items, const char* unit);
+
+void CloseMicrobench(struct Microbench* bench);
+
+// Sorts values in place and returns the middle one (the upper of the two
+// middle ones for an even count)
+double Median(double* values, int count);
+
+#endif
@@ -0,0 +1,108 @@
+#include "platform.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <shellapi.h>
+#include <stdlib.h>
+#endif
+
+void InitArguments(struct Arguments* arguments, int argc, char* argv[]) {
+    arguments->count = argc;
+    arguments->values = argv;
+    arguments->next = 1;
+}
+
+const char* NextArgument(struct Arguments* arguments) {
+    return arguments->next < arguments->count ? arguments->values[arguments->next++] : NULL;
+}
+
+int ParseDisplayOption(const char* argument, struct Arguments* arguments, struct DisplayOptions* options) {
+    if (SDL_strcmp(argument, "--offscreen") == 0) {
+        const char* frames = NextArgument(arguments);
+        options->offscreen_frames = frames ? SDL_atoi(frames) : 0;
+        if (options->offscreen_frames <= 0) options->offscreen_frames = OFFSCREEN_DEFAULT_FRAMES;
+        return 1;
+    }
+    if (SDL_strcmp(argument, "--output") == 0) {
+        const char* path = NextArgument(arguments);
+        if (path) SDL_strlcpy(options->output_path, path, sizeof(options->output_path));
+        return 1;
+    }
+    return 0;
+}
+
+int CreateDisplay(struct Display* display, const char* title, int width, int height, Uint32 window_flags, const struct DisplayOptions* options) {
+    SDL_zerop(display);
+    display->offscreen = options->offscreen_frames > 0;
+    display->frames_left = options->offscreen_frames;
+    SDL_strlcpy(display->output_path, options->output_path, sizeof(display->output_path));
+    if (display->offscreen) {
+        if (SDL_InitSubSystem(SDL_INIT_EVENTS) != 0) return -1;
+        display->surface = SDL_CreateRGBSurfaceWithFormat(0, width, height, 32, SDL_PIXELFORMAT_XRGB8888);
+        return display->surface ? 0 : -1;
+    }
+    if (SDL_InitSubSystem(SDL_INIT_VIDEO) != 0) return -1;
+    display->window = SDL_CreateWindow(title, SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, width, height, window_flags);
+    return display->window ? 0 : -1;
+}
+
+SDL_Surface* GetDisplaySurface(struct Display* display) {
+    // the window surface is replaced when the window is resized
+    return display->offscreen ? display->surface : SDL_GetWindowSurface(display->window);
+}
+
+SDL_Renderer* CreateDisplayRenderer(struct Display* display) {
+    display->renderer = display->offscreen
+                      ? SDL_CreateSoftwareRenderer(display->surface)
+                      : SDL_CreateRenderer(display->window, -1, SDL_RENDERER_ACCELERATED);
+    return display->renderer;
+}
+
+int PresentDisplay(struct Display* display) {
+    if (display->renderer) SDL_RenderPresent(display->renderer);
+    if (!display->offscreen) {
+        if (!display->renderer) SDL_UpdateWindowSurface(display->window);
+        return 1;
+    }
+    if (--display->frames_left > 0) return 1;
+    if (display->output_path[0] && SDL_SaveBMP(display->surface, display->output_path) != 0)
+        SDL_Log("Failed to save %s: %s", display->output_path, SDL_GetError());
+    return 0;
+}
+
+void DestroyDisplay(struct Display* display) {
+    if (display->renderer) SDL_DestroyRenderer(display->renderer);
+    if (display->window) SDL_DestroyWindow(display->window);
+    if (display->offscreen) SDL_FreeSurface(display->surface);
+    display->renderer = NULL;
+    display->window = NULL;
+    display->surface = NULL;
+}
+
+#ifdef _WIN32
+// Entry point of GUI subsystem builds; console builds start at main directly.
+// __argv is in the ANSI code page, so the arguments are taken from the wide
+// command line and passed on as UTF-8, the encoding SDL expects for paths.
+int main(int argc, char* argv[]);
+
+static char* WideToUtf8(const wchar_t* wide) {
+    int length = WideCharToMultiByte(CP_UTF8, 0, wide, -1, NULL, 0, NULL, NULL);
+    char* text = length > 0 ? SDL_malloc(length) : NULL;
+    if (text) WideCharToMultiByte(CP_UTF8, 0, wide, -1, text, length, NULL, NULL);
+    return text;
+}
+
+int WINAPI WinMain(HINSTANCE instance, HINSTANCE previous_instance, LPSTR command_line, int show_command) {
+    int argc = 0;
+    LPWSTR* wide_argv = CommandLineToArgvW(GetCommandLineW(), &argc);
+    char** argv = wide_argv ? SDL_calloc(argc + 1, sizeof(char*)) : NULL;
+    int converted = argv != NULL;
+    for (int i = 0; converted && i < argc; i++) converted = (argv[i] = WideToUtf8(wide_argv[i])) != NULL;
+    if (wide_argv) LocalFree(wide_argv);
+
+    int result = converted ? main(argc, argv) : main(__argc, __argv);
+    for (int i = 0; argv && i < argc; i++) SDL_free(argv[i]);
+    SDL_free(argv);
+    return result;
+}
+#endif
@@ -0,0 +1,64 @@
+#ifndef PLATFORM_H
+#define PLATFORM_H
+
+#include "SDL.h"
+
+// Frames --offscreen renders when no count follows it
+#define OFFSCREEN_DEFAULT_FRAMES 300
+#define OUTPUT_PATH_LENGTH 260
+
+// Output options every program takes:
+//   --offscreen [frames]  render into a memory surface instead of a window
+//                         and quit after that many frames
+//   --output file.bmp     save the last offscreen frame
+struct DisplayOptions {
+    int offscreen_frames;
+    char output_path[OUTPUT_PATH_LENGTH];
+};
+
+// argv read one argument at a time by the option parsers, so arguments
+// keep their spaces
+struct Arguments {
+    int count;
+    char** values;
+    int next;
+};
+
+// Starts after the program name in argv[0]
+void InitArguments(struct Arguments* arguments, int argc, char* argv[]);
+
+// Next argument, NULL once all are read
+const char* NextArgument(struct Arguments* arguments);
+
+// Consumes argument, and the value after it from arguments, when it is a
+// display option. Returns 1 when it was one.
+int ParseDisplayOption(const char* argument, struct Arguments* arguments, struct DisplayOptions* options);
+
+// A window, or offscreen a plain memory surface the programs draw into the
+// same way. Offscreen only the SDL event subsystem is initialized, so no
+// display or video driver is needed.
+struct Display {
+    SDL_Window* window;
+    SDL_Renderer* renderer;
+    SDL_Surface* surface;
+    int offscreen;
+    int frames_left;
+    char output_path[OUTPUT_PATH_LENGTH];
+};
+
+int CreateDisplay(struct Display* display, const char* title, int width, int height, Uint32 window_flags, const struct DisplayOptions* options);
+
+// Surface to draw a frame into, NULL on failure
+SDL_Surface* GetDisplaySurface(struct Display* display);
+
+// Accelerated renderer for the window, or a software one drawing into the
+// offscreen surface. Use either this or GetDisplaySurface, not both.
+SDL_Renderer* CreateDisplayRenderer(struct Display* display);
+
+// Shows the frame. Returns 0 once the last offscreen frame is done and
+// saved, 1 while the program should go on.
+int PresentDisplay(struct Display* display);
+
+void DestroyDisplay(struct Display* display);
+
+#endif
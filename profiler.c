@@ -0,0 +1,222 @@
+#include <stdio.h>
+#include "profiler.h"
+
+#ifdef _MSC_VER
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL _Thread_local
+#endif
+
+struct ProfileEvent {
+    const char* name;
+    Uint64 start;
+    Uint64 end;
+    int depth;
+};
+
+struct ProfileThread {
+    int index;
+    int depth;
+    const char* open_names[PROFILE_MAX_DEPTH];
+    Uint64 open_starts[PROFILE_MAX_DEPTH];
+    // events written so far, the ring holds the last PROFILE_RING_EVENTS
+    Uint64 written;
+    struct ProfileEvent events[PROFILE_RING_EVENTS];
+};
+
+// Frame time and the share of every stage, in counter ticks
+struct ProfileFrameTimes {
+    Uint64 total;
+    Uint64 stages[PROFILE_MAX_STAGES];
+};
+
+static struct Profiler {
+    int enabled;
+    int overlay;
+    char trace_path[OUTPUT_PATH_LENGTH];
+    Uint64 frequency;
+    Uint64 origin;
+    SDL_atomic_t thread_count;
+    struct ProfileThread threads[PROFILE_MAX_THREADS];
+    struct ProfileThread* frame_thread;
+    const char* stage_names[PROFILE_MAX_STAGES];
+    int stage_count;
+    Uint64 frame_start;
+    struct ProfileFrameTimes current;
+    struct ProfileFrameTimes history[PROFILE_GRAPH_FRAMES];
+    int history_head;
+} profiler;
+
+static THREAD_LOCAL struct ProfileThread* current_thread;
+static THREAD_LOCAL int thread_unprofiled;
+
+static const Uint32 stage_colors[PROFILE_MAX_STAGES] = {
+    0x4fa3ff, 0xff763b, 0x6ad16a, 0xd4c43b, 0xc26ad1, 0x3bd4c4, 0xff4f6a, 0xb0b0b0
+};
+
+int ParseProfileOption(const char* argument, struct Arguments* arguments, struct ProfileOptions* options) {
+    if (SDL_strcmp(argument, "--profile") == 0) {
+        options->overlay = 1;
+        return 1;
+    }
+    if (SDL_strcmp(argument, "--trace") == 0) {
+        const char* path = NextArgument(arguments);
+        if (path) SDL_strlcpy(options->trace_path, path, sizeof(options->trace_path));
+        return 1;
+    }
+    return 0;
+}
+
+// Slot of the calling thread, claimed on its first zone
+static struct ProfileThread* CurrentThread(void) {
+    if (current_thread || thread_unprofiled) return current_thread;
+    int index = SDL_AtomicAdd(&profiler.thread_count, 1);
+    if (index >= PROFILE_MAX_THREADS) {
+        thread_unprofiled = 1;
+        return NULL;
+    }
+    current_thread = &profiler.threads[index];
+    current_thread->index = index;
+    return current_thread;
+}
+
+void InitProfiler(const struct ProfileOptions* options) {
+    profiler.overlay = options->overlay;
+    SDL_strlcpy(profiler.trace_path, options->trace_path, sizeof(profiler.trace_path));
+    profiler.frequency = SDL_GetPerformanceFrequency();
+    profiler.origin = SDL_GetPerformanceCounter();
+    profiler.frame_start = profiler.origin;
+    profiler.enabled = 1;
+    profiler.frame_thread = CurrentThread();
+}
+
+void ProfileBegin(const char* name) {
+    if (!profiler.enabled) return;
+    struct ProfileThread* thread = CurrentThread();
+    if (!thread) return;
+    if (thread->depth < PROFILE_MAX_DEPTH) {
+        thread->open_names[thread->depth] = name;
+        thread->open_starts[thread->depth] = SDL_GetPerformanceCounter();
+    }
+    thread->depth++;
+}
+
+static void AddStageTime(const char* name, Uint64 ticks) {
+    int stage = 0;
+    while (stage < profiler.stage_count && profiler.stage_names[stage] != name) stage++;
+    if (stage == profiler.stage_count) {
+        if (stage == PROFILE_MAX_STAGES) return;
+        profiler.stage_names[profiler.stage_count++] = name;
+        SDL_Log("Profiler stage %s drawn as #%06x", name, (unsigned int) stage_colors[stage]);
+    }
+    profiler.current.stages[stage] += ticks;
+}
+
+void ProfileEnd(void) {
+    if (!profiler.enabled) return;
+    struct ProfileThread* thread = CurrentThread();
+    if (!thread || thread->depth == 0) return;
+    int depth = --thread->depth;
+    if (depth >= PROFILE_MAX_DEPTH) return;
+    struct ProfileEvent* event = &thread->events[thread->written++ % PROFILE_RING_EVENTS];
+    event->name = thread->open_names[depth];
+    event->start = thread->open_starts[depth];
+    event->end = SDL_GetPerformanceCounter();
+    event->depth = depth;
+    if (thread == profiler.frame_thread && depth == 0) AddStageTime(event->name, event->end - event->start);
+}
+
+void ProfileFrame(void) {
+    if (!profiler.enabled) return;
+    Uint64 now = SDL_GetPerformanceCounter();
+    profiler.current.total = now - profiler.frame_start;
+    profiler.history[profiler.history_head] = profiler.current;
+    profiler.history_head = (profiler.history_head + 1) % PROFILE_GRAPH_FRAMES;
+    SDL_zero(profiler.current);
+    profiler.frame_start = now;
+}
+
+int HandleProfileEvent(const SDL_Event* event) {
+    if (event->type != SDL_KEYDOWN || event->key.keysym.sym != SDLK_F3) return 0;
+    profiler.overlay = !profiler.overlay;
+    return 1;
+}
+
+// Calls fill for every rectangle of the overlay, oldest frame on the left
+static void DrawOverlay(int height, void (*fill)(void* target, const SDL_Rect* rect, Uint32 color), void* target) {
+    SDL_Rect panel = {0, height - PROFILE_GRAPH_HEIGHT, PROFILE_GRAPH_FRAMES, PROFILE_GRAPH_HEIGHT};
+    fill(target, &panel, 0x202020);
+    double pixels_per_tick = PROFILE_GRAPH_HEIGHT * 1000.0 / (PROFILE_GRAPH_MS * profiler.frequency);
+    for (int column = 0; column < PROFILE_GRAPH_FRAMES; column++) {
+        const struct ProfileFrameTimes* frame = &profiler.history[(profiler.history_head + column) % PROFILE_GRAPH_FRAMES];
+        int top = height;
+        int total = (int) SDL_min(frame->total * pixels_per_tick, PROFILE_GRAPH_HEIGHT);
+        SDL_Rect bar = {column, height - total, 1, total};
+        fill(target, &bar, 0x606060);
+        for (int stage = 0; stage < profiler.stage_count; stage++) {
+            int size = (int) SDL_min(frame->stages[stage] * pixels_per_tick, top - panel.y);
+            bar = (SDL_Rect) {column, top - size, 1, size};
+            fill(target, &bar, stage_colors[stage]);
+            top -= size;
+        }
+    }
+    SDL_Rect target_line = {0, height - (int) (PROFILE_GRAPH_HEIGHT * 1000.0 / 60 / PROFILE_GRAPH_MS), PROFILE_GRAPH_FRAMES, 1};
+    fill(target, &target_line, 0xffffff);
+}
+
+static void FillSurfaceRect(void* target, const SDL_Rect* rect, Uint32 color) {
+    SDL_Surface* surface = target;
+    SDL_FillRect(surface, rect, SDL_MapRGB(surface->format, color >> 16, (color >> 8) & 0xff, color & 0xff));
+}
+
+static void FillRendererRect(void* target, const SDL_Rect* rect, Uint32 color) {
+    SDL_SetRenderDrawColor(target, color >> 16, (color >> 8) & 0xff, color & 0xff, 255);
+    SDL_RenderFillRect(target, rect);
+}
+
+void DrawProfileOverlay(SDL_Surface* surface) {
+    if (profiler.enabled && profiler.overlay) DrawOverlay(surface->h, FillSurfaceRect, surface);
+}
+
+void RenderProfileOverlay(SDL_Renderer* renderer) {
+    int width, height;
+    if (!profiler.enabled || !profiler.overlay || SDL_GetRendererOutputSize(renderer, &width, &height) != 0) return;
+    DrawOverlay(height, FillRendererRect, renderer);
+}
+
+static int WriteTrace(const char* path) {
+    FILE* file = fopen(path, "w");
+    if (!file) return -1;
+    fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    int thread_count = SDL_min(SDL_AtomicGet(&profiler.thread_count), PROFILE_MAX_THREADS);
+    const char* separator = "";
+    double us_per_tick = 1e6 / profiler.frequency;
+    for (int t = 0; t < thread_count; t++) {
+        const struct ProfileThread* thread = &profiler.threads[t];
+        fprintf(file, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"%s\"}}",
+                separator, t, thread == profiler.frame_thread ? "frame" : "worker");
+        separator = ",\n";
+        Uint64 first = thread->written > PROFILE_RING_EVENTS ? thread->written - PROFILE_RING_EVENTS : 0;
+        for (Uint64 i = first; i < thread->written; i++) {
+            const struct ProfileEvent* event = &thread->events[i % PROFILE_RING_EVENTS];
+            fprintf(file, "%s{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}",
+                    separator, event->name, t, (event->start - profiler.origin) * us_per_tick, (event->end - event->start) * us_per_tick);
+        }
+    }
+    fprintf(file, "\n]}\n");
+    fclose(file);
+    return 0;
+}
+
+int ShutdownProfiler(void) {
+    int result = 0;
+    if (profiler.enabled && profiler.trace_path[0]) {
+        result = WriteTrace(profiler.trace_path);
+        if (result == 0)
+            SDL_Log("Wrote trace to %s", profiler.trace_path);
+        else
+            SDL_Log("Could not write %s", profiler.trace_path);
+    }
+    profiler.enabled = 0;
+    return result;
+}
@@ -0,0 +1,56 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include "SDL.h"
+#include "platform.h"
+
+// Threads that can record zones, later ones are not profiled
+#define PROFILE_MAX_THREADS 32
+// Completed zones kept per thread, the oldest are overwritten
+#define PROFILE_RING_EVENTS 8192
+#define PROFILE_MAX_DEPTH 16
+// Top level zones of the frame thread stacked in the overlay graph
+#define PROFILE_MAX_STAGES 8
+#define PROFILE_GRAPH_FRAMES 240
+#define PROFILE_GRAPH_HEIGHT 100
+// Frame time at the top of the graph
+#define PROFILE_GRAPH_MS 33.3
+
+// Profiler options every program takes:
+//   --profile            show the frame graph overlay (F3 toggles it)
+//   --trace file.json    write the recorded zones as Chrome trace events
+//                        (chrome://tracing, Perfetto) on exit
+struct ProfileOptions {
+    int overlay;
+    char trace_path[OUTPUT_PATH_LENGTH];
+};
+
+// Same contract as ParseDisplayOption
+int ParseProfileOption(const char* argument, struct Arguments* arguments, struct ProfileOptions* options);
+
+// Starts recording; the calling thread becomes the frame thread whose top
+// level zones make up the overlay graph. Before this zones cost one branch.
+void InitProfiler(const struct ProfileOptions* options);
+
+// Writes the trace when one was asked for and stops recording
+int ShutdownProfiler(void);
+
+// Zones nest per thread and name must outlive the profiler (a literal);
+// graph stages are told apart by the name pointer. Recording is a counter
+// read into a per-thread ring, nothing is allocated.
+void ProfileBegin(const char* name);
+void ProfileEnd(void);
+
+// Ends a frame of the frame thread, call once per main loop iteration
+void ProfileFrame(void);
+
+// F3 toggles the overlay. Returns 1 when the event was taken.
+int HandleProfileEvent(const SDL_Event* event);
+
+// Draws the rolling frame graph into the bottom left corner: one column per
+// frame, the stages stacked in their colors over the whole frame in gray,
+// with a line at 60 Hz
+void DrawProfileOverlay(SDL_Surface* surface);
+void RenderProfileOverlay(SDL_Renderer* renderer);
+
+#endif
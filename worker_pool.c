@@ -0,0 +1,62 @@
+#include "worker_pool.h"
+#include "profiler.h"
+
+static void RunJobs(struct WorkerPool* pool) {
+    int index;
+    ProfileBegin("jobs");
+    while ((index = SDL_AtomicAdd(&pool->next_job, 1)) < pool->job_count) {
+        pool->job(pool->context, index);
+    }
+    ProfileEnd();
+}
+
+static int WorkerThread(void* data) {
+    struct WorkerPool* pool = data;
+    while (1) {
+        SDL_SemWait(pool->start);
+        if (pool->quit) break;
+        RunJobs(pool);
+        SDL_SemPost(pool->done);
+    }
+    return 0;
+}
+
+int CreateWorkerPool(struct WorkerPool* pool, int thread_count) {
+    SDL_zerop(pool);
+    pool->thread_count = 1;
+    pool->start = SDL_CreateSemaphore(0);
+    pool->done = SDL_CreateSemaphore(0);
+    if (!pool->start || !pool->done) return -1;
+    thread_count = SDL_clamp(thread_count, 1, MAX_THREADS);
+    pool->thread_count = thread_count;
+    for (int i = 1; i < thread_count; i++) {
+        pool->threads[i] = SDL_CreateThread(WorkerThread, "worker", pool);
+        if (!pool->threads[i]) {
+            pool->thread_count = i;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void DestroyWorkerPool(struct WorkerPool* pool) {
+    pool->quit = 1;
+    for (int i = 1; i < pool->thread_count; i++)
+        SDL_SemPost(pool->start);
+    for (int i = 1; i < pool->thread_count; i++)
+        SDL_WaitThread(pool->threads[i], NULL);
+    if (pool->start) SDL_DestroySemaphore(pool->start);
+    if (pool->done) SDL_DestroySemaphore(pool->done);
+}
+
+void DispatchJobs(struct WorkerPool* pool, void (*job)(void*, int), void* context, int job_count) {
+    pool->job = job;
+    pool->context = context;
+    pool->job_count = job_count;
+    SDL_AtomicSet(&pool->next_job, 0);
+    for (int i = 1; i < pool->thread_count; i++)
+        SDL_SemPost(pool->start);
+    RunJobs(pool);
+    for (int i = 1; i < pool->thread_count; i++)
+        SDL_SemWait(pool->done);
+}
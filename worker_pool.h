@@ -0,0 +1,28 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include "SDL.h"
+
+#define MAX_THREADS 64
+
+// Worker pool: the calling thread and thread_count - 1 workers pull job
+// indices from a shared counter until job_count is reached
+struct WorkerPool {
+    int thread_count;
+    SDL_Thread* threads[MAX_THREADS];
+    SDL_sem* start;
+    SDL_sem* done;
+    SDL_atomic_t next_job;
+    int job_count;
+    void (*job)(void* context, int index);
+    void* context;
+    int quit;
+};
+
+int CreateWorkerPool(struct WorkerPool* pool, int thread_count);
+void DestroyWorkerPool(struct WorkerPool* pool);
+
+// Runs job(context, 0 .. job_count - 1) on the pool and returns once every job is finished
+void DispatchJobs(struct WorkerPool* pool, void (*job)(void*, int), void* context, int job_count);
+
+#endif